@@ -0,0 +1,79 @@
+#! /bin/bash
+# bench.sh -- compares the server I/O engines on loopback.
+#
+# usage: ./bench.sh [size in MB] [connections] [extra server options]
+#
+# Serves one file of random bytes to the client once per engine, first
+# to measure the server's cpu time (from the rusage line it prints on
+# SIGINT), then again under syscount to count its system calls. Prints
+# system calls per MB and cpu seconds per GB for each engine, and for
+# GSO trains with a full window of stamped frames. Then runs
+# the client under syscount with and without its write-behind buffer and
+# with its mapped output, and prints its disk writes per GB.
+
+SIZE_MB=${1:-32}
+CONNS=${2:-4}
+shift 2 2>/dev/null
+EXTRA="$@"
+
+# the checked in binaries may be stale, always build fresh ones, from a
+# copy of the sources so nothing in the tree is touched.
+SRC=$(cd "$(dirname "$0")" && pwd)
+DIR=$(mktemp -d /tmp/mftp-bench.XXXXXX)
+mkdir -p $DIR/build $DIR/srv $DIR/cli
+cp "$SRC"/*.c "$SRC"/*.h "$SRC"/Makefile "$SRC"/movecli.sh $DIR/build/
+touch $DIR/build/server-info.txt
+make -s -C $DIR/build server client syscount > /dev/null || { rm -rf $DIR; exit 1; }
+cp $DIR/build/server $DIR/build/syscount $DIR/srv/
+cp $DIR/build/clientdir/client $DIR/build/syscount $DIR/cli/
+head -c $((SIZE_MB * 1048576)) /dev/urandom > $DIR/srv/bench.bin
+BYTES=$(stat -c %s $DIR/srv/bench.bin)
+
+# runs one transfer, $1 and $2 are command prefixes for the server and
+# the client.
+run() {
+   PORT=$((20000 + RANDOM % 20000))
+   for i in $(seq 1 $CONNS); do echo "127.0.0.1 $PORT"; done > $DIR/cli/server-info.txt
+   rm -f $DIR/cli/bench.bin
+   (cd $DIR/srv && exec $1 ./server -t 1 $EXTRA $ENGINE $PORT > $DIR/srv.log 2> $DIR/srv.err) &
+   SRV=$!
+   sleep 0.5
+   START=$(date +%s%N)
+   (cd $DIR/cli && timeout 300 $2 ./client $CLIOPTS bench.bin $CONNS > /dev/null 2> $DIR/cli.err)
+   END=$(date +%s%N)
+   kill -INT $SRV
+   wait $SRV
+   if ! cmp -s $DIR/srv/bench.bin $DIR/cli/bench.bin; then
+      echo "bench: transfer with '$ENGINE' did not match the source file." >&2
+   fi
+   MS=$(( (END - START) / 1000000 ))
+}
+
+printf "%-10s %10s %12s %12s %10s\n" engine "wall ms" "syscalls" "calls/MB" "cpu s/GB"
+for ENGINE in "" "-u" "-g -w 256 -a fixed"; do
+   run ""
+   CPU=$(awk '/^Server:/ { print $2 + $5 }' $DIR/srv.log)
+   WALL=$MS
+   run "./syscount"
+   CALLS=$(awk '/^syscount: [0-9]+ system calls/ { print $2 }' $DIR/srv.err)
+   NAME=${ENGINE:-epoll}
+   [ "$ENGINE" = "-u" ] && NAME=io_uring
+   [ "$ENGINE" = "-g -w 256 -a fixed" ] && NAME=gso
+   awk -v n="$NAME" -v ms="$WALL" -v c="$CALLS" -v cpu="$CPU" -v b="$BYTES" 'BEGIN {
+      printf "%-10s %10d %12d %12.1f %10.3f\n", n, ms, c, c * 1048576 / b, cpu * 1073741824 / b
+   }'
+   grep "^syscount: " $DIR/srv.err | sed -n 2,6p | sed "s/^syscount:/    /"
+done
+
+echo
+printf "%-10s %10s %12s %12s\n" client "wall ms" "disk writes" "writes/GB"
+ENGINE=""
+for CLIOPTS in "-b 0" "" "-m"; do
+   run "" "./syscount"
+   WRITES=$(awk '/^syscount: +[0-9]+ (pwrite64|pwritev)$/ { n += $2 } END { print n + 0 }' $DIR/cli.err)
+   NAME=${CLIOPTS:-"-b 1024"}
+   awk -v n="$NAME" -v ms="$MS" -v w="$WRITES" -v b="$BYTES" 'BEGIN {
+      printf "%-10s %10d %12d %12.0f\n", n, ms, w, w * 1073741824 / b
+   }'
+done
+rm -rf $DIR
@@ -0,0 +1,688 @@
+// File: catalog.c
+// Created October 17, 2026
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+
+// comment this out to turn on debug prints.
+//#define NDEBUG NDEBUG
+
+#include "catalog.h"
+#include "utils.h"
+
+// what the event thread listens for on the directory.
+#define CATALOG_EVENTS (IN_CREATE | IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB \
+                        | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+// marks a snapshot written with the reader's byte order.
+#define CATALOG_ORDER 0x01020304
+
+// FNV-1a over the file name.
+static unsigned int name_hash(const char *name);
+
+// sets up an empty table with mask + 1 buckets.
+static int table_init(catalog_table *t, unsigned int mask);
+
+// finds the node for name, NULL if there is none.
+static catalog_node *table_find(const catalog_table *t, const char *name);
+
+// adds or updates name, st NULL records it as missing.
+static catalog_node *table_put(catalog_table *t, const char *name, const struct stat *st);
+
+// removes name if it is there.
+static void table_del(catalog_table *t, const char *name);
+
+// frees every node and the buckets.
+static void table_free(catalog_table *t);
+
+// names that may be served, not paths and not the snapshot.
+static int served_name(const char *name);
+
+// stats name in the directory, 1 if it is a regular file.
+static int stat_regular(const char *name, struct stat *st);
+
+// reads the whole directory into a new table and swaps it in.
+static int catalog_scan(catalog *cat);
+
+// 1 once catalog_destroy asked the event thread to stop.
+static int catalog_stopping(catalog *cat);
+
+// maps the snapshot if it is there and its header is sound.
+static int snap_load(catalog *cat);
+
+// finds name in the snapshot, checking each record as it is read.
+static const catalog_snap_record *snap_find(const catalog *cat, const char *name);
+
+// checksums a queued file if the catalog still has no checksum for it.
+static void catalog_hash_file(catalog *cat, const char *name);
+
+// copies the snapshot's checksum to n if the file did not change.
+static void snap_carry(const catalog *cat, catalog_node *n);
+
+// writes the table to a new snapshot and renames it into place.
+static void snap_save(catalog *cat);
+
+// rescans if needed, then applies inotify events until catalog_destroy.
+static void *catalog_loop(void *arg);
+
+int catalog_init(catalog *cat) {
+    memset(cat, 0, sizeof(*cat));
+    cat->ifd = -1;
+    cat->pipefd[0] = cat->pipefd[1] = -1;
+    cat->hashfd[0] = cat->hashfd[1] = -1;
+    if (!table_init(&cat->table, 1023)) {
+        fprintf(stderr, "Error: calloc() of catalog failed.\n");
+        return 0;
+    }
+    pthread_rwlock_init(&cat->lock, NULL);
+    pthread_mutex_init(&cat->hashlock, NULL);
+
+    // watch before scanning so nothing created in between is missed.
+    cat->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cat->ifd >= 0 && inotify_add_watch(cat->ifd, ".", CATALOG_EVENTS | IN_ONLYDIR) < 0) {
+        close(cat->ifd);
+        cat->ifd = -1;
+    }
+    if (cat->ifd < 0) {
+        fprintf(stderr, "Warning: inotify unavailable (%s), looking files up with stat().\n",
+                strerror(errno));
+        return 1;
+    }
+    if (snap_load(cat)) {
+        // serve from the snapshot now, the event thread rescans.
+        cat->loaded = 1;
+        DEBUGF("Catalog: %u files in snapshot.\n", ((const catalog_snap_header *)cat->snap)->count);
+    } else {
+        if (!catalog_scan(cat)) {
+            catalog_destroy(cat);
+            return 0;
+        }
+        snap_save(cat);
+        DEBUGF("Catalog: %u files indexed.\n", cat->table.count);
+    }
+    // wakeups for queued checksums never block a worker.
+    if (pipe(cat->pipefd) < 0 || pipe2(cat->hashfd, O_NONBLOCK) < 0) {
+        perror("Error: pipe() for catalog failed ");
+        catalog_destroy(cat);
+        return 0;
+    }
+    int i = pthread_create(&cat->thread, NULL, catalog_loop, cat);
+    if (i != 0) {
+        fprintf(stderr, "Error: pthread_create() of catalog failed: %s.\n", strerror(i));
+        catalog_destroy(cat);
+        return 0;
+    }
+    cat->running = 1;
+    return 1;
+}
+
+int catalog_lookup(catalog *cat, const char *name, catalog_entry *meta) {
+    if (!served_name(name)) {
+        return 0;
+    }
+    struct stat st;
+    if (cat->ifd < 0) {
+        if (!stat_regular(name, &st)) {
+            return 0;
+        }
+        meta->size = st.st_size;
+        meta->mtime = st.st_mtime;
+        meta->ino = st.st_ino;
+        meta->checksum = 0;
+        return 1;
+    }
+    pthread_rwlock_rdlock(&cat->lock);
+    catalog_node *n = table_find(&cat->table, name);
+    int complete = cat->complete;
+    int found = n != NULL && n->present;
+    if (found) {
+        *meta = n->meta;
+    }
+    pthread_rwlock_unlock(&cat->lock);
+    if (n != NULL || complete) {
+        return found;
+    }
+
+    // started from the snapshot and the rescan is not done: check the
+    // name once, later lookups and inotify events keep it current.
+    int regular = stat_regular(name, &st);
+    pthread_rwlock_wrlock(&cat->lock);
+    n = table_find(&cat->table, name);
+    if (n == NULL && !cat->complete) {
+        n = table_put(&cat->table, name, regular ? &st : NULL);
+        if (n != NULL && regular) {
+            snap_carry(cat, n);
+        }
+        cat->checks++;
+    }
+    found = n != NULL && n->present;
+    if (found) {
+        *meta = n->meta;
+    }
+    pthread_rwlock_unlock(&cat->lock);
+    return found;
+}
+
+void catalog_set_checksum(catalog *cat, const char *name, const catalog_entry *meta) {
+    if (cat->ifd < 0) {
+        return;
+    }
+    pthread_rwlock_wrlock(&cat->lock);
+    catalog_node *n = table_find(&cat->table, name);
+    if (n != NULL && n->present && n->meta.size == meta->size && n->meta.mtime == meta->mtime
+        && n->meta.ino == meta->ino) {
+        n->meta.checksum = meta->checksum;
+    }
+    pthread_rwlock_unlock(&cat->lock);
+}
+
+void catalog_want_checksum(catalog *cat, const char *name) {
+    if (!cat->running) {
+        return;
+    }
+    pthread_mutex_lock(&cat->hashlock);
+    catalog_hash **link = &cat->hashq;
+    while (*link != NULL && strcmp((*link)->name, name) != 0) {
+        link = &(*link)->next;
+    }
+    if (*link == NULL) {
+        catalog_hash *h = malloc(sizeof(catalog_hash) + strlen(name) + 1);
+        if (h != NULL) {
+            h->next = NULL;
+            strcpy(h->name, name);
+            *link = h;
+        }
+    }
+    pthread_mutex_unlock(&cat->hashlock);
+    // a full pipe already has the thread awake.
+    if (write(cat->hashfd[1], "", 1) < 0 && errno != EAGAIN) {
+        perror("Error: waking catalog failed ");
+    }
+}
+
+void catalog_destroy(catalog *cat) {
+    if (cat->running) {
+        if (write(cat->pipefd[1], "", 1) != 1) {
+            perror("Error: stopping catalog failed ");
+        }
+        pthread_join(cat->thread, NULL);
+        cat->running = 0;
+        // keep what the events changed for the next start.
+        if (cat->complete) {
+            snap_save(cat);
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (cat->pipefd[i] >= 0) close(cat->pipefd[i]);
+        cat->pipefd[i] = -1;
+        if (cat->hashfd[i] >= 0) close(cat->hashfd[i]);
+        cat->hashfd[i] = -1;
+    }
+    while (cat->hashq != NULL) {
+        catalog_hash *next = cat->hashq->next;
+        free(cat->hashq);
+        cat->hashq = next;
+    }
+    if (cat->ifd >= 0) {
+        close(cat->ifd);
+        cat->ifd = -1;
+    }
+    if (cat->snap != NULL) {
+        munmap((void *)cat->snap, cat->snaplen);
+        cat->snap = NULL;
+    }
+    if (cat->table.buckets != NULL) {
+        table_free(&cat->table);
+        pthread_rwlock_destroy(&cat->lock);
+        pthread_mutex_destroy(&cat->hashlock);
+    }
+}
+
+void print_catalog_stats(catalog *cat) {
+    pthread_rwlock_rdlock(&cat->lock);
+    printf("Catalog: %u files, %lu inotify events, %lu rescans, %lu names checked, "
+           "%lu checksums%s\n", cat->table.count, cat->events, cat->rescans, cat->checks, cat->hashed,
+           cat->loaded ? ", started from snapshot" : "");
+    pthread_rwlock_unlock(&cat->lock);
+}
+
+static unsigned int name_hash(const char *name) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; ++p) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int table_init(catalog_table *t, unsigned int mask) {
+    t->mask = mask;
+    t->count = 0;
+    t->buckets = calloc(mask + 1, sizeof(catalog_node *));
+    return t->buckets != NULL;
+}
+
+static catalog_node *table_find(const catalog_table *t, const char *name) {
+    catalog_node *n = t->buckets[name_hash(name) & t->mask];
+    while (n != NULL && strcmp(n->name, name) != 0) {
+        n = n->hnext;
+    }
+    return n;
+}
+
+static catalog_node *table_put(catalog_table *t, const char *name, const struct stat *st) {
+    catalog_node *n = table_find(t, name);
+    if (n == NULL) {
+        if (t->count > t->mask) {
+            // double the buckets, keep the old ones if memory is short.
+            unsigned int mask = t->mask * 2 + 1;
+            catalog_node **buckets = calloc(mask + 1, sizeof(catalog_node *));
+            if (buckets != NULL) {
+                for (unsigned int i = 0; i <= t->mask; ++i) {
+                    catalog_node *e = t->buckets[i];
+                    while (e != NULL) {
+                        catalog_node *next = e->hnext;
+                        unsigned int b = name_hash(e->name) & mask;
+                        e->hnext = buckets[b];
+                        buckets[b] = e;
+                        e = next;
+                    }
+                }
+                free(t->buckets);
+                t->buckets = buckets;
+                t->mask = mask;
+            }
+        }
+        size_t len = strlen(name) + 1;
+        n = malloc(sizeof(catalog_node) + len);
+        if (n == NULL) {
+            fprintf(stderr, "Error: malloc() of catalog entry failed.\n");
+            return NULL;
+        }
+        memset(n, 0, sizeof(catalog_node));
+        memcpy(n->name, name, len);
+        unsigned int b = name_hash(name) & t->mask;
+        n->hnext = t->buckets[b];
+        t->buckets[b] = n;
+        t->count++;
+    }
+    if (st == NULL) {
+        n->present = 0;
+        memset(&n->meta, 0, sizeof(n->meta));
+        return n;
+    }
+    if (!n->present || n->meta.size != st->st_size || n->meta.mtime != st->st_mtime
+        || n->meta.ino != st->st_ino) {
+        // a checksum of the old contents says nothing about the new ones.
+        n->meta.checksum = 0;
+    }
+    n->present = 1;
+    n->meta.size = st->st_size;
+    n->meta.mtime = st->st_mtime;
+    n->meta.ino = st->st_ino;
+    return n;
+}
+
+static void table_del(catalog_table *t, const char *name) {
+    catalog_node **link = &t->buckets[name_hash(name) & t->mask];
+    while (*link != NULL) {
+        if (strcmp((*link)->name, name) == 0) {
+            catalog_node *n = *link;
+            *link = n->hnext;
+            free(n);
+            t->count--;
+            return;
+        }
+        link = &(*link)->hnext;
+    }
+}
+
+static void table_free(catalog_table *t) {
+    for (unsigned int i = 0; i <= t->mask; ++i) {
+        catalog_node *n = t->buckets[i];
+        while (n != NULL) {
+            catalog_node *next = n->hnext;
+            free(n);
+            n = next;
+        }
+    }
+    free(t->buckets);
+    t->buckets = NULL;
+    t->count = 0;
+}
+
+static int served_name(const char *name) {
+    return strchr(name, '/') == NULL && strcmp(name, CATALOG_SNAPSHOT) != 0
+        && strcmp(name, CATALOG_SNAPSHOT ".tmp") != 0;
+}
+
+static int stat_regular(const char *name, struct stat *st) {
+    return stat(name, st) == 0 && S_ISREG(st->st_mode);
+}
+
+static int catalog_scan(catalog *cat) {
+    DIR *d = opendir(".");
+    if (d == NULL) {
+        perror("Error: opendir() of served directory failed ");
+        return 0;
+    }
+    // built without the lock, lookups go on against the old table.
+    catalog_table t;
+    if (!table_init(&t, 1023)) {
+        fprintf(stderr, "Error: calloc() of catalog failed.\n");
+        closedir(d);
+        return 0;
+    }
+    struct dirent *dir = NULL;
+    unsigned long seen = 0;
+    while ((dir = readdir(d)) != NULL) {
+        if (++seen % 4096 == 0 && catalog_stopping(cat)) {
+            table_free(&t);
+            closedir(d);
+            return 0;
+        }
+        if (dir->d_type != DT_REG && dir->d_type != DT_LNK && dir->d_type != DT_UNKNOWN) {
+            continue;
+        }
+        struct stat st;
+        if (served_name(dir->d_name) && stat_regular(dir->d_name, &st)) {
+            catalog_node *n = table_put(&t, dir->d_name, &st);
+            if (n != NULL) {
+                snap_carry(cat, n);
+            }
+        }
+    }
+    closedir(d);
+
+    pthread_rwlock_wrlock(&cat->lock);
+    catalog_table old = cat->table;
+    cat->table = t;
+    cat->complete = 1;
+    const char *snap = cat->snap;
+    cat->snap = NULL;
+    pthread_rwlock_unlock(&cat->lock);
+    table_free(&old);
+    if (snap != NULL) {
+        munmap((void *)snap, cat->snaplen);
+    }
+    return 1;
+}
+
+static int catalog_stopping(catalog *cat) {
+    if (cat->pipefd[0] < 0) {
+        return 0;
+    }
+    struct pollfd pfd;
+    pfd.fd = cat->pipefd[0];
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) > 0;
+}
+
+static int snap_load(catalog *cat) {
+    int fd = open(CATALOG_SNAPSHOT, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(catalog_snap_header)) {
+        close(fd);
+        return 0;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    // only the header is checked here, records are checked as they are read.
+    const catalog_snap_header *h = map;
+    uint64_t buckets_end = sizeof(catalog_snap_header) + (uint64_t)h->nbuckets * sizeof(uint32_t);
+    if (memcmp(h->magic, "MFTPCAT", 8) != 0 || h->version != CATALOG_VERSION
+        || h->order != CATALOG_ORDER || h->nbuckets == 0
+        || (h->nbuckets & (h->nbuckets - 1)) != 0 || h->records % 8 != 0
+        || h->records < buckets_end || h->names < h->records
+        || (h->names - h->records) / sizeof(catalog_snap_record) < h->count
+        || h->names > len || h->nameslen > len - h->names) {
+        fprintf(stderr, "Warning: %s is damaged or from another version, rescanning.\n",
+                CATALOG_SNAPSHOT);
+        munmap(map, len);
+        return 0;
+    }
+    cat->snap = map;
+    cat->snaplen = len;
+    return 1;
+}
+
+static const catalog_snap_record *snap_find(const catalog *cat, const char *name) {
+    if (cat->snap == NULL) {
+        return NULL;
+    }
+    const catalog_snap_header *h = (const catalog_snap_header *)cat->snap;
+    const uint32_t *buckets = (const uint32_t *)(cat->snap + sizeof(catalog_snap_header));
+    const catalog_snap_record *records = (const catalog_snap_record *)(cat->snap + h->records);
+    const char *names = cat->snap + h->names;
+    size_t len = strlen(name);
+    uint32_t i = buckets[name_hash(name) & (h->nbuckets - 1)];
+    // a damaged chain can not loop forever or point outside the file.
+    for (uint32_t hops = 0; i != 0 && i <= h->count && hops < h->count; ++hops) {
+        const catalog_snap_record *r = &records[i - 1];
+        if (r->namelen == len && (uint64_t)r->name + r->namelen <= h->nameslen
+            && memcmp(names + r->name, name, len) == 0) {
+            return r;
+        }
+        i = r->next;
+    }
+    return NULL;
+}
+
+static void snap_carry(const catalog *cat, catalog_node *n) {
+    const catalog_snap_record *r = snap_find(cat, n->name);
+    if (r != NULL && r->size == n->meta.size && r->mtime == (int64_t)n->meta.mtime
+        && r->ino == (uint64_t)n->meta.ino) {
+        n->meta.checksum = r->checksum;
+    }
+}
+
+static void snap_save(catalog *cat) {
+    pthread_rwlock_rdlock(&cat->lock);
+    catalog_table *t = &cat->table;
+    uint32_t count = 0;
+    uint64_t nameslen = 0;
+    for (unsigned int i = 0; i <= t->mask; ++i) {
+        for (catalog_node *n = t->buckets[i]; n != NULL; n = n->hnext) {
+            if (n->present) {
+                count++;
+                nameslen += strlen(n->name);
+            }
+        }
+    }
+    uint32_t nbuckets = 16;
+    while (nbuckets < 2 * count) {
+        nbuckets *= 2;
+    }
+    uint32_t *buckets = calloc(nbuckets, sizeof(uint32_t));
+    catalog_snap_record *records = calloc(count + 1, sizeof(catalog_snap_record));
+    char *names = malloc(nameslen + 1);
+    if (buckets == NULL || records == NULL || names == NULL || nameslen > UINT32_MAX) {
+        pthread_rwlock_unlock(&cat->lock);
+        fprintf(stderr, "Warning: catalog snapshot not saved, out of memory.\n");
+        free(buckets);
+        free(records);
+        free(names);
+        return;
+    }
+    uint32_t idx = 0;
+    uint32_t off = 0;
+    for (unsigned int i = 0; i <= t->mask; ++i) {
+        for (catalog_node *n = t->buckets[i]; n != NULL; n = n->hnext) {
+            if (!n->present) continue;
+            catalog_snap_record *r = &records[idx];
+            uint32_t len = (uint32_t)strlen(n->name);
+            memcpy(names + off, n->name, len);
+            r->name = off;
+            r->namelen = len;
+            r->checksum = n->meta.checksum;
+            r->size = n->meta.size;
+            r->mtime = n->meta.mtime;
+            r->ino = n->meta.ino;
+            uint32_t b = name_hash(n->name) & (nbuckets - 1);
+            r->next = buckets[b];
+            buckets[b] = ++idx;
+            off += len;
+        }
+    }
+    pthread_rwlock_unlock(&cat->lock);
+
+    catalog_snap_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "MFTPCAT", 8);
+    h.version = CATALOG_VERSION;
+    h.order = CATALOG_ORDER;
+    h.count = count;
+    h.nbuckets = nbuckets;
+    // records start on an 8 byte boundary after the buckets.
+    h.records = (sizeof(h) + (uint64_t)nbuckets * sizeof(uint32_t) + 7) & ~(uint64_t)7;
+    h.names = h.records + (uint64_t)count * sizeof(catalog_snap_record);
+    h.nameslen = nameslen;
+    static const char pad[8];
+    size_t padlen = h.records - sizeof(h) - (uint64_t)nbuckets * sizeof(uint32_t);
+
+    // written aside and renamed, a reader never sees half a snapshot.
+    FILE *out = fopen(CATALOG_SNAPSHOT ".tmp", "w");
+    int ok = out != NULL
+          && fwrite(&h, sizeof(h), 1, out) == 1
+          && fwrite(buckets, sizeof(uint32_t), nbuckets, out) == nbuckets
+          && fwrite(pad, 1, padlen, out) == padlen
+          && fwrite(records, sizeof(catalog_snap_record), count, out) == count
+          && fwrite(names, 1, nameslen, out) == nameslen;
+    if (out != NULL && fclose(out) != 0) {
+        ok = 0;
+    }
+    if (!ok || rename(CATALOG_SNAPSHOT ".tmp", CATALOG_SNAPSHOT) < 0) {
+        fprintf(stderr, "Warning: catalog snapshot not saved: %s.\n", strerror(errno));
+        unlink(CATALOG_SNAPSHOT ".tmp");
+    } else {
+        DEBUGF("Catalog: snapshot of %u files saved.\n", count);
+    }
+    free(buckets);
+    free(records);
+    free(names);
+}
+
+static void *catalog_loop(void *arg) {
+    catalog *cat = arg;
+    if (!cat->complete) {
+        // started from the snapshot, bring it up to date in the background.
+        if (catalog_scan(cat)) {
+            snap_save(cat);
+            DEBUGF("Catalog: %u files after the rescan.\n", cat->table.count);
+        }
+    }
+    // room for a burst of events, aligned for struct inotify_event.
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd[3];
+    pfd[0].fd = cat->ifd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = cat->pipefd[0];
+    pfd[1].events = POLLIN;
+    pfd[2].fd = cat->hashfd[0];
+    pfd[2].events = POLLIN;
+    for (;;) {
+        if (poll(pfd, 3, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("Error: poll() in catalog failed ");
+            break;
+        }
+        if (pfd[1].revents != 0) {
+            break;
+        }
+        if (pfd[2].revents != 0) {
+            while (read(cat->hashfd[0], buf, sizeof(buf)) > 0) {
+                // one pass takes every wakeup queued so far.
+            }
+            for (;;) {
+                pthread_mutex_lock(&cat->hashlock);
+                catalog_hash *h = cat->hashq;
+                if (h != NULL) {
+                    cat->hashq = h->next;
+                }
+                pthread_mutex_unlock(&cat->hashlock);
+                if (h == NULL) {
+                    break;
+                }
+                if (!catalog_stopping(cat)) {
+                    catalog_hash_file(cat, h->name);
+                }
+                free(h);
+            }
+        }
+        if (pfd[0].revents == 0) {
+            continue;
+        }
+        ssize_t n = read(cat->ifd, buf, sizeof(buf));
+        if (n <= 0) {
+            continue;
+        }
+        int overflow = 0;
+        // the whole burst is applied under one write lock.
+        pthread_rwlock_wrlock(&cat->lock);
+        for (char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            cat->events++;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                overflow = 1;
+                continue;
+            }
+            if (ev->len == 0 || (ev->mask & IN_ISDIR) || !served_name(ev->name)) {
+                continue;
+            }
+            struct stat st;
+            if ((ev->mask & (IN_DELETE | IN_MOVED_FROM)) || !stat_regular(ev->name, &st)) {
+                table_del(&cat->table, ev->name);
+            } else {
+                table_put(&cat->table, ev->name, &st);
+            }
+        }
+        pthread_rwlock_unlock(&cat->lock);
+        if (overflow) {
+            // events were lost, only a full scan brings the table back.
+            DEBUGF("Catalog: inotify queue overflowed, rescanning.\n");
+            if (catalog_scan(cat)) {
+                cat->rescans++;
+                snap_save(cat);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void catalog_hash_file(catalog *cat, const char *name) {
+    catalog_entry meta;
+    if (!catalog_lookup(cat, name, &meta) || meta.checksum != 0) {
+        return;
+    }
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    // only the version the catalog knows gets its checksum.
+    if (fstat(fd, &st) == 0 && st.st_ino == meta.ino && st.st_size == meta.size
+        && st.st_mtime == meta.mtime) {
+        meta.checksum = file_checksum(fd, meta.size);
+        catalog_set_checksum(cat, name, &meta);
+        cat->hashed++;
+        DEBUGF("Catalog: checksum of %s is %08x.\n", name, meta.checksum);
+    }
+    close(fd);
+}
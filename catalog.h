@@ -0,0 +1,189 @@
+// File: catalog.h
+// Created October 17, 2026
+
+#ifndef __CATALOG_H__
+#define __CATALOG_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/**
+ * @file catalog.h
+ * Index of the regular files in the served directory. Looking a file up
+ * is a hash probe and never scans the directory, no matter how many
+ * files it holds; a thread applies inotify(7) events to the table.
+ *
+ * The table is saved to a snapshot file in the directory. When a valid
+ * snapshot is there at startup it is mapped with one mmap(2) instead of
+ * reading the directory, and the server can serve at once: each name is
+ * checked with one stat(2) the first time it is asked for, while the
+ * catalog thread rescans the directory in the background and replaces
+ * the snapshot with what it finds.
+ *
+ * Checksums are computed by the same thread, never by a worker: a file
+ * whose checksum is not known yet is queued with catalog_want_checksum
+ * and served with checksum 0 until the thread has read it.
+ */
+
+/**
+ * Snapshot file in the served directory. It and its temporary file are
+ * never served.
+ */
+#define CATALOG_SNAPSHOT ".mftp-catalog"
+
+/**
+ * Snapshot layout version, bumped when the records change.
+ */
+#define CATALOG_VERSION 1
+
+/**
+ * What the catalog knows about one file.
+ */
+typedef struct catalog_entry {
+    long long size;                 // size in bytes.
+    time_t mtime;                   // last modification.
+    ino_t ino;                      // inode, changes if the file is replaced.
+    uint32_t checksum;              // content checksum, 0 if not known.
+} catalog_entry;
+
+/**
+ * One name in the table. The name is allocated with the node.
+ */
+typedef struct catalog_node {
+    struct catalog_node *hnext;     // next node in the same bucket.
+    int present;                    // 0 marks a name checked and not found.
+    catalog_entry meta;
+    char name[];
+} catalog_node;
+
+/**
+ * A hash table of names.
+ */
+typedef struct catalog_table {
+    catalog_node **buckets;         // chains linked through hnext.
+    unsigned int mask;              // bucket count - 1, a power of two.
+    unsigned int count;             // nodes in the table.
+} catalog_table;
+
+/**
+ * Snapshot file header. The bucket array follows it, then the records,
+ * then the names. All offsets are from the start of the file.
+ */
+typedef struct catalog_snap_header {
+    char magic[8];                  // "MFTPCAT" and a nul.
+    uint32_t version;               // CATALOG_VERSION.
+    uint32_t order;                 // 0x01020304 in the writer's byte order.
+    uint32_t count;                 // records.
+    uint32_t nbuckets;              // buckets, a power of two.
+    uint64_t records;               // offset of the records.
+    uint64_t names;                 // offset of the names.
+    uint64_t nameslen;              // bytes of names.
+} catalog_snap_header;
+
+/**
+ * One file in the snapshot. Buckets and next hold record index + 1,
+ * 0 ends a chain.
+ */
+typedef struct catalog_snap_record {
+    uint32_t next;                  // next record in the same bucket.
+    uint32_t name;                  // offset of the name in the names.
+    uint32_t namelen;               // its length, no nul.
+    uint32_t checksum;              // content checksum, 0 if not known.
+    int64_t size;
+    int64_t mtime;
+    uint64_t ino;
+} catalog_snap_record;
+
+/**
+ * A name waiting for the catalog thread to checksum it.
+ */
+typedef struct catalog_hash {
+    struct catalog_hash *next;
+    char name[];
+} catalog_hash;
+
+/**
+ * The catalog of the current directory.
+ */
+typedef struct catalog {
+    pthread_rwlock_t lock;          // lookups read, the event thread writes.
+    catalog_table table;            // names checked, scanned or changed.
+    int complete;                   // table holds every file, no stat needed.
+    const char *snap;               // mapped snapshot, NULL once replaced.
+    size_t snaplen;                 // length of snap.
+    int ifd;                        // inotify descriptor, -1 without inotify.
+    int pipefd[2];                  // wakes the event thread to stop.
+    int hashfd[2];                  // wakes the event thread to checksum files.
+    pthread_mutex_t hashlock;       // guards hashq.
+    catalog_hash *hashq;            // names waiting for a checksum, oldest first.
+    unsigned long hashed;           // checksums the thread computed.
+    pthread_t thread;               // applies inotify events.
+    int running;                    // thread was started.
+    int loaded;                     // started from a snapshot.
+    unsigned long events;           // inotify events applied.
+    unsigned long rescans;          // full scans after startup.
+    unsigned long checks;           // names checked with stat before a scan finished.
+} catalog;
+
+/**
+ * Loads the snapshot or indexes the current directory, and starts
+ * following its changes. Without inotify the catalog still works, each
+ * lookup then falls back to a stat(2) of the name.
+ *
+ * @param cat The catalog.
+ *
+ * @return 1 on success, 0 if memory is short or the directory can not
+ *         be read.
+ */
+int catalog_init(catalog *cat);
+
+/**
+ * Looks a file up by name. Names with a '/' never match, only files in
+ * the directory itself are served.
+ *
+ * @param cat The catalog.
+ * @param name The file name.
+ * @param meta Filled in with the file's metadata when it is found.
+ *
+ * @return 1 if the file is in the catalog, 0 if not.
+ */
+int catalog_lookup(catalog *cat, const char *name, catalog_entry *meta);
+
+/**
+ * Records the checksum of a file's contents, so it is saved in the
+ * snapshot. Nothing changes unless the catalog still has the file with
+ * the same size, mtime and inode.
+ *
+ * @param cat The catalog.
+ * @param name The file name.
+ * @param meta The file's metadata and the checksum of those contents.
+ */
+void catalog_set_checksum(catalog *cat, const char *name, const catalog_entry *meta);
+
+/**
+ * Asks the catalog thread to checksum a file, if it is still not known
+ * when the thread gets to it. Returns at once, catalog_lookup has the
+ * checksum once it is done. Does nothing without inotify.
+ *
+ * @param cat The catalog.
+ * @param name The file name.
+ */
+void catalog_want_checksum(catalog *cat, const char *name);
+
+/**
+ * Stops the event thread, saves the snapshot and frees the table.
+ *
+ * @param cat The catalog.
+ */
+void catalog_destroy(catalog *cat);
+
+/**
+ * Prints the file count, how many events were applied and how many
+ * checksums were computed.
+ *
+ * @param cat The catalog.
+ */
+void print_catalog_stats(catalog *cat);
+
+#endif
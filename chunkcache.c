@@ -0,0 +1,149 @@
+// File: chunkcache.c
+// Created October 17, 2026
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+// comment this out to turn on debug prints.
+//#define NDEBUG NDEBUG
+
+#include "chunkcache.h"
+#include "utils.h"
+
+// spreads file and offset over the buckets.
+static unsigned int block_hash(ino_t ino, long long offset);
+
+// takes a block out of its bucket and the LRU list.
+static void block_unlink(chunk_cache *c, chunk_block *b);
+
+// makes b the most recently used block.
+static void block_touch(chunk_cache *c, chunk_block *b);
+
+int chunk_cache_init(chunk_cache *c, size_t budget) {
+    memset(c, 0, sizeof(*c));
+    c->budget = budget;
+    // about two buckets per block the budget holds.
+    c->mask = 63;
+    while ((size_t)(c->mask + 1) * CHUNK_BLOCK_SIZE < 2 * budget && c->mask < (1u << 24) - 1) {
+        c->mask = c->mask * 2 + 1;
+    }
+    c->buckets = calloc(c->mask + 1, sizeof(chunk_block *));
+    if (c->buckets == NULL) {
+        fprintf(stderr, "Error: calloc() of chunk cache failed.\n");
+        return 0;
+    }
+    return 1;
+}
+
+chunk_block *chunk_cache_find(chunk_cache *c, const cached_file *f, long long offset) {
+    chunk_block *b = c->buckets[block_hash(f->ino, offset) & c->mask];
+    while (b != NULL) {
+        if (b->offset == offset && b->ino == f->ino && b->size == f->size
+            && b->mtime == f->mtime) {
+            block_touch(c, b);
+            return b;
+        }
+        b = b->hnext;
+    }
+    return NULL;
+}
+
+int chunk_cache_full(const chunk_cache *c, int len) {
+    return c->bytes + len > c->budget && c->tail != NULL;
+}
+
+chunk_block *chunk_cache_fill(chunk_cache *c, const cached_file *f, long long offset, int len) {
+    if (len <= 0 || len > CHUNK_BLOCK_SIZE || (size_t)len > c->budget) {
+        return NULL;
+    }
+    while (c->bytes + len > c->budget && c->tail != NULL) {
+        chunk_block *old = c->tail;
+        block_unlink(c, old);
+        c->bytes -= old->len;
+        c->evictions++;
+        free(old);
+    }
+    chunk_block *b = malloc(sizeof(chunk_block) + len);
+    if (b == NULL) {
+        return NULL;
+    }
+    // one read fills every segment of the block.
+    int numbytes = 0;
+    while (numbytes < len) {
+        ssize_t x = pread(f->fd, b->data + numbytes, len - numbytes, offset + numbytes);
+        if (x <= 0) {
+            fprintf(stderr, "Warning: pread() of cache block stopped at %d bytes.\n", numbytes);
+            free(b);
+            return NULL;
+        }
+        numbytes += (int)x;
+    }
+    b->ino = f->ino;
+    b->size = f->size;
+    b->mtime = f->mtime;
+    b->offset = offset;
+    b->len = len;
+    b->prev = b->next = NULL;
+    unsigned int h = block_hash(f->ino, offset) & c->mask;
+    b->hnext = c->buckets[h];
+    c->buckets[h] = b;
+    block_touch(c, b);
+    c->bytes += len;
+    return b;
+}
+
+void chunk_cache_destroy(chunk_cache *c) {
+    chunk_block *b = c->head;
+    while (b != NULL) {
+        chunk_block *next = b->next;
+        free(b);
+        b = next;
+    }
+    free(c->buckets);
+    c->buckets = NULL;
+    c->head = c->tail = NULL;
+    c->bytes = 0;
+}
+
+void print_chunk_cache_stats(const chunk_cache *c, const char *who) {
+    printf("%s chunk cache: %lu hits %lu misses %lu evictions, %zu of %zu bytes\n",
+           who, c->hits, c->misses, c->evictions, c->bytes, c->budget);
+}
+
+static unsigned int block_hash(ino_t ino, long long offset) {
+    unsigned long long h = (unsigned long long)ino * 0x9e3779b97f4a7c15ull
+                         ^ (unsigned long long)offset * 0xc2b2ae3d27d4eb4full;
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+static void block_unlink(chunk_cache *c, chunk_block *b) {
+    chunk_block **link = &c->buckets[block_hash(b->ino, b->offset) & c->mask];
+    while (*link != NULL && *link != b) {
+        link = &(*link)->hnext;
+    }
+    if (*link == b) {
+        *link = b->hnext;
+    }
+    b->hnext = NULL;
+    if (b->prev != NULL) b->prev->next = b->next;
+    else c->head = b->next;
+    if (b->next != NULL) b->next->prev = b->prev;
+    else c->tail = b->prev;
+    b->prev = b->next = NULL;
+}
+
+static void block_touch(chunk_cache *c, chunk_block *b) {
+    if (c->head == b) return;
+    // out of its place in the list, if it has one.
+    if (b->prev != NULL) b->prev->next = b->next;
+    if (b->next != NULL) b->next->prev = b->prev;
+    else if (c->tail == b) c->tail = b->prev;
+    b->prev = NULL;
+    b->next = c->head;
+    if (c->head != NULL) c->head->prev = b;
+    c->head = b;
+    if (c->tail == NULL) c->tail = b;
+}
@@ -0,0 +1,127 @@
+// File: chunkcache.h
+// Created October 17, 2026
+
+#ifndef __CHUNKCACHE_H__
+#define __CHUNKCACHE_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "rudp.h"
+#include "filecache.h"
+
+/**
+ * @file chunkcache.h
+ * Per worker cache of file data in send-ready blocks. A block holds
+ * CHUNK_BLOCK_SIZE bytes of a file starting at a multiple of that size,
+ * so sessions share blocks however their clients split the file. Every
+ * data frame of a hit is sent straight out of the block with no read
+ * and no copy, only its header is written; a segment that straddles two
+ * blocks is read the usual way. Blocks hold raw file data, not whole
+ * frames, since each frame's header is per connection. Blocks are keyed
+ * by the file's inode, size and mtime and the block's file offset, so a
+ * changed file never hits old data. The cache is owned by one worker and
+ * takes no locks.
+ */
+
+/**
+ * Segments in one block.
+ */
+#define CHUNK_BLOCK_SEGS 64
+
+/**
+ * Bytes in one full block.
+ */
+#define CHUNK_BLOCK_SIZE (CHUNK_BLOCK_SEGS * SEGMENT_SIZE)
+
+/**
+ * Part of a file, read from it once.
+ */
+typedef struct chunk_block {
+    ino_t ino;                      // file the data came from.
+    long long size;
+    time_t mtime;
+    long long offset;               // file offset of data[0].
+    int len;                        // bytes in data.
+    struct chunk_block *hnext;      // next block in the same bucket.
+    struct chunk_block *prev;       // more recently used block.
+    struct chunk_block *next;       // less recently used block.
+    char data[];
+} chunk_block;
+
+/**
+ * The blocks of one worker.
+ */
+typedef struct chunk_cache {
+    chunk_block **buckets;          // chains linked through hnext.
+    unsigned int mask;              // bucket count - 1, a power of two.
+    chunk_block *head;              // most recently used block.
+    chunk_block *tail;              // least recently used block.
+    size_t bytes;                   // data held.
+    size_t budget;                  // most data held before evicting.
+    unsigned long hits;             // segments sent from a block already cached.
+    unsigned long misses;           // segments that needed a read of the file.
+    unsigned long evictions;        // blocks dropped to stay in budget.
+} chunk_cache;
+
+/**
+ * Sets up an empty cache.
+ *
+ * @param c The cache.
+ * @param budget Bytes of file data the cache may hold.
+ *
+ * @return 1 on success, 0 if memory is short.
+ */
+int chunk_cache_init(chunk_cache *c, size_t budget);
+
+/**
+ * Finds a block and makes it the most recently used. The caller counts
+ * the hit or miss once it knows whether the segment was sent from it.
+ *
+ * @param c The cache.
+ * @param f The file.
+ * @param offset File offset the block starts at.
+ *
+ * @return The block, or NULL on a miss.
+ */
+chunk_block *chunk_cache_find(chunk_cache *c, const cached_file *f, long long offset);
+
+/**
+ * Tells whether adding len bytes would evict blocks. Frames queued on
+ * the worker's batch may point into them, so the caller drains it first.
+ *
+ * @param c The cache.
+ * @param len Size of the block to add.
+ *
+ * @return 1 if blocks would be evicted.
+ */
+int chunk_cache_full(const chunk_cache *c, int len);
+
+/**
+ * Reads a block from the file with pread and adds it, evicting the least
+ * recently used blocks to stay within the budget.
+ *
+ * @param c The cache.
+ * @param f The file.
+ * @param offset File offset of the block.
+ * @param len Bytes in the block, at most CHUNK_BLOCK_SIZE.
+ *
+ * @return The block, or NULL if memory is short or the read came up short.
+ */
+chunk_block *chunk_cache_fill(chunk_cache *c, const cached_file *f, long long offset, int len);
+
+/**
+ * Frees every block.
+ *
+ * @param c The cache.
+ */
+void chunk_cache_destroy(chunk_cache *c);
+
+/**
+ * Prints the hit, miss and eviction counters.
+ *
+ * @param c The cache.
+ * @param who Name of the owner for the line.
+ */
+void print_chunk_cache_stats(const chunk_cache *c, const char *who);
+
+#endif
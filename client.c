@@ -5,16 +5,17 @@
 /*******
 NAME
      client -- contacts a server to obtain a chunk of a file from the server 
-               using pthreadds. Collects all chunks then it puts them together 
-               to form a whole file.
+               using pthreadds. Each chunk is written straight to its place 
+               in the file.
 
 SYNOPSIS
      client <filename> <number of connections>
 
 DESCRIPTION
      This program contacts a server to obtain a chunk of a file from the server 
-     using pthreadds. Collects all chunks then it puts them together 
-     to form a whole file.
+     using pthreadds. The server tells each thread where its chunk starts, 
+     and the thread writes every packet at its offset in the file, so no 
+     temp files are made and nothing is put together at the end.
 
 OPERANDS
      The two operands are first an filename to be retreived, and second a 
@@ -45,6 +46,7 @@ EXIT STATUS
 #include <string.h>      // string lib
 #include <pthread.h>     // pthread lib
 #include <sys/stat.h>    // stats lib
+#include <fcntl.h>       // open(2), fallocate(2)
 
 // comment out for no debugging prints statements
 //#define NDEBUG NDEBUG
@@ -59,6 +61,66 @@ EXIT STATUS
 
 static uint8_t exit_status = SUCCESS;
 
+// largest write-behind buffer per thread in KB.
+#define MAX_WRITE_BEHIND 65536
+
+// a server silent for this many microseconds has gone away.
+#define SERVER_TIMEOUT 30000000LL
+
+// the file being downloaded, every thread pwrites its chunk into it.
+static int outfd = -1;
+
+// bytes each thread gathers before a write, 0 writes every packet.
+static int write_size = WRITE_BEHIND_SIZE;
+
+// with -m each thread maps its chunk and copies packets into it.
+static int map_output = FALSE;
+
+// every connection acks after this many data packets, or once the
+// oldest unacked one has waited ack_delay microseconds.
+static int ack_every = ACK_EVERY;
+static long long ack_delay = ACK_DELAY;
+
+// packets sent back to the servers and file bytes received, all threads.
+static unsigned long reverse_packets = 0;
+static long long received_bytes = 0;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// what the server says about the file, taken from the ack of the filename.
+struct file_meta {
+    long long size;
+    long long mtime;
+    unsigned int checksum;
+};
+
+// the first announcement, every connection must agree with it.
+static struct file_meta announced;
+static int have_announced = FALSE;
+static pthread_mutex_t announce_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// set when chunk 0's reply came first and carried the whole file, the
+// other connections have nothing to fetch.
+static int whole_file = FALSE;
+
+// size and mtime of the file as it was before the download, its
+// checksum is only read once they match the announcement.
+static struct file_meta local;
+
+// set when the local copy already matches, nothing is transferred.
+static int up_to_date = FALSE;
+
+// records a connection's announcement. The first one sizes the file.
+// Returns 1 if the local copy is current or another connection brings
+// the whole file, 0 to transfer, -1 if the file changed between
+// connections.
+static int announce_file(const struct file_meta *m, int whole);
+
+// returns 1 once another connection's reply carried the whole file.
+static int came_whole(void);
+
+// copies a packet's payload out as a nul terminated string.
+static void payload_text(const mftp_view *p, char *buf, int size);
+
 // checks for "ERROR" in buffers which is an app layer error from teh server.
 void check_error(char *x, char *y);
 
@@ -76,36 +138,70 @@ unsigned char *serialize_threadargs(struct threadargs, unsigned char buffer[]);
 struct threadargs deserialize_threadargs(unsigned char buffer[]);
 
 int main(int argc, char **argv) {
-  // Usage check
-  // Only allow 3 or 4 arguments.
-  if (argc != 3) {
-    fprintf(stderr, "Usage: %s [filename> <num-connections>\n", argv[0]);
-    exit_status = FAILURE;
-    return exit_status;
-  }
-
    char *filename = NULL;
    int connectnum = 0;
    
    opterr = FALSE;
    for (;;) {
-      int option = getopt (argc, argv, "");
+      int option = getopt (argc, argv, "a:b:d:m");
       if (option == EOF) {
-         char *endptr = NULL;
-         if (3 == argc) {
-             filename = argv[1];
-             connectnum = (uint16_t)strtol(argv[2], &endptr, 10);
+         if (argc - optind != 2) {
+            fprintf(stderr, "Usage: %s [-a packets] [-b kilobytes] [-d usec] [-m] <filename> <num-connections>\n", argv[0]);
+            exit_status = FAILURE;
+            return exit_status;
          }
-         if (*endptr != '\0') {
-            fprintf(stderr, "Error: Invalid number of connections: %s.\n", argv[2]);
+         char *endptr = NULL;
+         filename = argv[optind];
+         connectnum = (uint16_t)strtol(argv[optind + 1], &endptr, 10);
+         if (*endptr != '\0' || connectnum < 1) {
+            fprintf(stderr, "Error: Invalid number of connections: %s.\n", argv[optind + 1]);
             return FAILURE;
          }
          DEBUGF("Filename: %s. Connections: %d.\n", filename, connectnum);
          break;
       }
       switch (option) {
+         case 'a':
+         {
+            char *endptr = NULL;
+            long n = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || n < 1 || n > MAX_WINDOW) {
+               fprintf(stderr, "Error: Invalid ack interval: %s (1 - %d packets).\n", optarg, MAX_WINDOW);
+               exit_status = FAILURE;
+               return exit_status;
+            }
+            ack_every = (int)n;
+            break;
+         }
+         case 'b':
+         {
+            char *endptr = NULL;
+            long kb = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || kb < 0 || kb > MAX_WRITE_BEHIND) {
+               fprintf(stderr, "Error: Invalid write buffer size: %s (0 - %d KB).\n", optarg, MAX_WRITE_BEHIND);
+               exit_status = FAILURE;
+               return exit_status;
+            }
+            write_size = (int)kb * 1024;
+            break;
+         }
+         case 'd':
+         {
+            char *endptr = NULL;
+            long usec = strtol(optarg, &endptr, 10);
+            if (*endptr != '\0' || usec < 0 || usec > RTO_MIN) {
+               fprintf(stderr, "Error: Invalid ack delay: %s (0 - %d usec).\n", optarg, RTO_MIN);
+               exit_status = FAILURE;
+               return exit_status;
+            }
+            ack_delay = usec;
+            break;
+         }
+         case 'm':
+            map_output = TRUE;
+            break;
          default : fprintf (stderr, "Error: -%c: invalid option\n", optopt);
-                   fprintf(stderr, "Usage: %s [filename> <num-connections>\n", argv[0]);
+                   fprintf(stderr, "Usage: %s [-a packets] [-b kilobytes] [-d usec] [-m] <filename> <num-connections>\n", argv[0]);
                    exit_status = FAILURE;
                    return exit_status;
       };
@@ -132,6 +228,18 @@ int main(int argc, char **argv) {
      perror(" file server-info.txt not found");
      return(errno);
   }
+  // open the file once, the threads fill in their ranges. An existing
+  // copy is only cut to size once the server's checksum says it differs.
+  outfd = open(filename, O_RDWR | O_CREAT, 0644);
+  struct stat st;
+  if (outfd < 0 || fstat(outfd, &st) < 0) {
+     fprintf(stderr, "Error: Creation of file: %s failed: %s.\n", filename, strerror(errno));
+     fclose(serverlist);
+     return FAILURE;
+  }
+  local.size = st.st_size;
+  local.mtime = st.st_mtime;
+
   char buf[64];
   bzero(buf, sizeof(buf));
   int validipnum = 0;
@@ -199,6 +307,7 @@ int main(int argc, char **argv) {
 
   if (validipnum == 0) {
       fprintf(stderr, "All servers in the list failed.\n");
+      close(outfd);
       exit(FAILURE);
   }
 
@@ -208,21 +317,22 @@ int main(int argc, char **argv) {
     DEBUGF("Thread returned. valid:%d\n", validipnum);
     threadexit[i] = result;
   }
-  DEBUGF("All threads have complete. Building file.\n");
+  DEBUGF("All threads have complete.\n");
   
   // find a good server incase one of the threads failed to get a chunk.
   int good_server = -1;
   DEBUGF("Searching for good server.\n");
   for (int i = 0; i < validipnum; ++i) {
-     struct stat stats;
-     char buffer[256];
-     bzero(buffer, sizeof(buffer));
-     sprintf(buffer, "%d", i);
-     if (stat(buffer, &stats) == 0) { 
+     if ((long)threadexit[i] == SUCCESS) { 
         good_server = i;
         break;
      }
   }
+  if (good_server == -1) {
+     fprintf(stderr, "Error: no server sent its chunk of %s.\n", filename);
+     close(outfd);
+     return FAILURE;
+  }
   
   // check to make sure all threads didnt fail 
   DEBUGF("Checking thread returns for failed threads.\n");
@@ -252,79 +362,37 @@ int main(int argc, char **argv) {
   for (int i = 0; i < validipnum; i++) {
       free(targ[i]);
   }
-  
 
-  // build full file from file parts.
+  // every chunk was written in place, the file is complete once all are in.
+  int status = SUCCESS;
   for (int i = 0; i < validipnum; ++i) {
-
-    // create or open the new file.
-    FILE *newfile = NULL;
-    if (i == 0) {
-        newfile = fopen(filename, "w+");
-    } else {
-        newfile = fopen(filename, "a"); 
-    }
-    if (newfile == NULL) {
-       fprintf(stderr, "Error: Creation of file: %s failed.\n", filename);
-       return FAILURE;
-    } else {
-       DEBUGF("File opened.\n");
-    }
-
-    // open the thread files.
-    char buffer[16];
-    bzero(buffer, sizeof(buffer));
-    sprintf(buffer, "%d", i);
-    FILE *threadfile = fopen(buffer, "r");
-    if (threadfile == NULL) {
-       fprintf(stderr, "Error: Couldn't read file: %s .Failure.\n", buffer);
-       fclose(newfile);
-       return FAILURE;
-    } else {
-       DEBUGF("File: %s opened.\n", buffer);
-    }
-
-    // get thread file size
-    int filesize = get_file_size(threadfile);
-    char buf[filesize+1];
-    bzero(buf, sizeof(buf));
-
-    // read contents of thread file and write to main file
-    int rc = read(fileno(threadfile), buf, sizeof(buf));
-    if (rc == filesize) {
-        DEBUGF("Read threadfile succesfully.\n");
-    } else {
-        DEBUGF("Something went wrong the reading the thread file.\n");
-    }
-
-    int wc = write(fileno(newfile), buf, filesize);
-    if (wc < 0) {
-       fprintf(stderr, "Error: write(2) error when write to file: %s.\n", filename);
-       fclose(threadfile);
-       fclose(newfile);
-       return FAILURE;
-    } else {
-       DEBUGF("Write Success: %s.\n", filename);
-    }
-    fclose(newfile);
-    fclose(threadfile);
-    
-    // clean up threadfile.
-    int rm = remove(buffer);
-    if (rm == 0) {
-        DEBUGF("Clean up for file: %s successful.\n", buffer);
-    } else {
-        DEBUGF("Something went wrong on clean up. %s.\n", strerror(errno));
-    }
+      if ((long)threadexit[i] == FAILURE) {
+          fprintf(stderr, "Error: chunk %d of %s could not be retrieved.\n", i, filename);
+          status = FAILURE;
+      }
   }
-
-  // write newline on file for some systems.  
-  FILE* newfile = fopen(filename, "a"); 
-  write(fileno(newfile), "\n", strlen("\n"));
-  fclose(newfile);
-  
-  
-  return SUCCESS;
+  if (received_bytes > 0) {
+      printf("Reverse path: %lu packets for %lld bytes, %.1f per MB\n", reverse_packets,
+             received_bytes, reverse_packets * 1048576.0 / received_bytes);
+  }
+  if (status == SUCCESS && up_to_date) {
+      printf("File: %s is already up to date.\n", filename);
+  } else if (status == SUCCESS) {
+      // keep the server's mtime, so the copy can be told apart later.
+      struct timespec times[2];
+      times[0].tv_sec = 0;
+      times[0].tv_nsec = UTIME_NOW;
+      times[1].tv_sec = (time_t)announced.mtime;
+      times[1].tv_nsec = 0;
+      if (futimens(outfd, times) < 0) {
+          DEBUGF("futimens() of %s failed: %s.\n", filename, strerror(errno));
+      }
+  }
+  if (close(outfd) < 0) {
+      fprintf(stderr, "Error: close(2) of %s failed: %s.\n", filename, strerror(errno));
+      status = FAILURE;
+  }
+  return status;
 }
 
 
@@ -346,12 +414,35 @@ void *thread_get_chunk(void *arg) {
 
    // set up server information
    int seqnum = 1;
+   // every packet of this connection carries the id, the server uses it
+   // and our address to find the session.
+   unsigned int conn = new_conn_id();
    sockinfo.sin_port = htons(targ.port);
    inet_aton(targ.address, &sockinfo.sin_addr);
 
-   // send empty packet to server
-   DEBUGF("Thread %d Sending ack to server to start data transfer.\n", targ.validipnum);
-   send_ack(seqnum++, clisock, sockinfo, sizeof(sockinfo));
+   // one request carries the filename, which chunk of how many and how
+   // many packets we can hold, the server answers with the first window.
+   mftp_packet last_p;
+   last_p.conn = conn;
+   last_p.flag = REQ;
+   last_p.seq = seqnum++;
+   last_p.opts = 0;
+   snprintf(last_p.data, sizeof(last_p.data), "%u %u %d %s", targ.cnum, targ.validipnum,
+            MAX_WINDOW, targ.filename);
+   last_p.len = strlen(last_p.data);
+   DEBUGF("Thread %d requesting chunk: %s.\n", targ.validipnum, last_p.data);
+   if (send_dgram(clisock, &sockinfo, sizeof(sockinfo), last_p) == FALSE) {
+       fprintf(stderr, "Error: sendto()) error.\n");
+       close(clisock);
+       pthread_exit((void*)FAILURE);
+   }
+   long long last_request = current_time_usec();
+   // the reply to a request sent once times the round trip, which sets
+   // how long a quiet connection waits before sending again.
+   int requests = 1;
+   rtt_estimator rtt;
+   rtt_init(&rtt);
+   long long last_heard = last_request;
 
    // create MAIN timeout for if the connection goes dead for a while then
    // exit the thread. here i can use alarm() and signal(SIGARLRM, handler)
@@ -364,24 +455,87 @@ void *thread_get_chunk(void *arg) {
 
    // loop forever until the exit or done message is given.
    // if the timeval tv expires in select a retranmission should occur.
-   int last_packet = ACK;
-   int last_packet_seq = seqnum - 1;
-   int file_seq_num = 0;
-   mftp_packet last_p;
+   int last_packet = REQ;
    char state = 1;
    int breakloop = 0;
-   sockaddr_in servinfo;
+   sockaddr_in servinfo = sockinfo;
    uint slen = (uint)sizeof(servinfo);
-   int connection_timeouts = 0;
+   // file offset the next in order segment is written at.
+   long long woffset = 0;
+
+   // with -m the chunk is mapped once its range is known.
+   char *outmap = NULL;
+   size_t outmaplen = 0;
+   char *chunkdata = NULL;
+   long long chunklen = 0;
+   // set when the whole file follows the reply and no session is kept.
+   int inline_data = FALSE;
+   // data came in this batch and the policy wants it acked now.
+   int ack_due = 0;
+   unsigned char ack_opts = 0;
+   unsigned int ack_ts = 0;
+   ack_policy acks;
+   ack_policy_init(&acks, ack_every, ack_delay);
+   // control packets sent outside the batch, the request is the first.
+   unsigned long controls = 1;
+
+   // in order data is gathered here and written a block at a time.
+   write_behind wb;
+   if (!write_behind_init(&wb, outfd, map_output ? 0 : write_size)) {
+       close(clisock);
+       pthread_exit((void*)FAILURE);
+   }
+
+   // out of order segments wait here until they can be written.
+   recv_window *window = malloc(sizeof(recv_window));
+   if (window == NULL) {
+       fprintf(stderr, "Error: malloc() of receive window failed.\n");
+       close(clisock);
+       write_behind_free(&wb);
+       pthread_exit((void*)FAILURE);
+   }
+   recv_window_init(window);
+
+   // acks for a whole batch of data go back in one system call.
+   rudp_batch *batch = malloc(sizeof(rudp_batch));
+   if (batch == NULL) {
+       fprintf(stderr, "Error: malloc() of datagram batch failed.\n");
+       close(clisock);
+       free(window);
+       write_behind_free(&wb);
+       pthread_exit((void*)FAILURE);
+   }
+   batch_init(batch, clisock);
+   // let the kernel coalesce bursts of data packets, batch_recv splits them.
+   if (!batch_enable_gro(batch)) {
+       DEBUGF("Thread %d GRO unavailable, one datagram per packet.\n", targ.validipnum);
+   }
 
    // loop until entire chunk of file has been recieved. 
    int exitstatus = SUCCESS;
    while (1) {
 
+       // wake for a held ack before the retransmit timer if it is sooner.
+       long long wait = rtt.rto;
+       long long ack_wait = ack_policy_timeout(&acks, current_time_usec());
+       int ack_timer = ack_wait >= 0 && ack_wait < wait;
+       if (ack_timer) {
+           wait = ack_wait;
+       }
        struct timeval tv = {0,0};
-       tv.tv_sec = 5;
+       tv.tv_sec = wait / 1000000;
+       tv.tv_usec = wait % 1000000;
        fd_set read_fds = master;
 
+       if (state == 1 && came_whole()) {
+           // every connection starts at once, another one's reply
+           // already brought the whole file. A session our request
+           // may have opened is dropped.
+           DEBUGF("Thread %d file came whole on another connection.\n", targ.validipnum);
+           send_frame(clisock, &servinfo, slen, DONE, 0, conn, seqnum++, NULL, 0);
+           controls++;
+           state = 6;
+       }
        if (state == 6) break;// break from while if we reached last stage
        DEBUGF("Thread %d Posix thread waiting on select().\n", targ.validipnum);
 
@@ -396,120 +550,234 @@ void *thread_get_chunk(void *arg) {
 
        if (FD_ISSET(clisock, &read_fds)) {
           // process server response.
-          unsigned char buffer[1100];
-          bzero(buffer, sizeof(buffer));
-          int result = recvfrom(clisock, buffer, sizeof(buffer),
-                        0, (sockaddr*)&servinfo, &slen);
+          int result = batch_recv(batch);
           if (result == -1) {
               // handle error
-              perror("Error: recvfrom() failed. Exiting thread.");
+              perror("Error: recvmmsg() failed. Exiting thread.");
+              close(clisock);
+              free(window);
+              write_behind_free(&wb);
+              unmap_file(outmap, outmaplen);
+              batch_destroy(batch);
+              free(batch);
               pthread_exit((void*)FAILURE);
-          } else {
-              mftp_packet sdata = parse_dgram(buffer);
+          }
+          for (int i = 0; i < result && state != 6; ++i) {
+              mftp_view sdata;
+              if (!batch_view(batch, i, &sdata, &servinfo)) {
+                  DEBUGF("Thread %d dropping malformed datagram.\n", targ.validipnum);
+                  continue;
+              }
+              if (sdata.conn != conn) {
+                  DEBUGF("Thread %d dropping packet of connection %u.\n", targ.validipnum, sdata.conn);
+                  continue;
+              }
               DEBUGF("Thread %d, data = %.10s, flag = %d, seq = %d.\n", targ.validipnum, sdata.data, sdata.flag, sdata.seq);
 
               // if server sends an error exit thread. 
               if (sdata.flag == ERROR) {
+                  close(clisock);
+                  free(window);
+                  write_behind_free(&wb);
+                  unmap_file(outmap, outmaplen);
+                  batch_destroy(batch);
+                  free(batch);
                   pthread_exit((void*)FAILURE);
               }
+              last_heard = current_time_usec();
 
               // process packet
               switch (state) {
-                case 1: // send filename
+                case 1: // wait for the reply to the request.
                 {
-                    mftp_packet fileinfo;
-                    fileinfo.flag = DATA;
-                    fileinfo.seq = seqnum++;   
-                    memcpy(fileinfo.data, targ.filename, 256);
-                    last_p = fileinfo;
-                    DEBUGF("Thread %d File: %s requested. Sending to server.\n", targ.validipnum, fileinfo.data);
-                    int wc = send_dgram(clisock, &servinfo, slen, fileinfo);
-                    if (wc == FALSE) {
-                       fprintf(stderr, "Error: sendto()) error.\n");
+                    if (sdata.flag == DATA) {
+                        // data came but our reply did not, ask again now
+                        // and then, the server resends the dropped data.
+                        if (last_heard - last_request >= rtt.rto) {
+                            send_dgram(clisock, &servinfo, slen, last_p);
+                            last_request = last_heard;
+                            requests++;
+                            controls++;
+                        }
+                        break;
+                    }
+                    if (sdata.flag != ACK || sdata.seq != last_p.seq) {
+                        DEBUGF("Thread %d ignoring stale packet %u.\n", targ.validipnum, sdata.seq);
+                        break;
+                    }
+                    if (requests == 1) {
+                        rtt_sample(&rtt, last_heard - last_request);
+                    }
+                    // the reply describes the file and where the chunk goes.
+                    char text[96];
+                    struct file_meta meta;
+                    payload_text(&sdata, text, sizeof(text));
+                    if (sscanf(text, "%lld %lld %x %lld %lld", &meta.size, &meta.mtime, &meta.checksum,
+                               &woffset, &chunklen) != 5 || meta.size < 0) {
+                       fprintf(stderr, "Error: server sent no valid reply for %s.\n", targ.filename);
                        close(clisock);
+                       free(window);
+                       write_behind_free(&wb);
+                       batch_destroy(batch);
+                       free(batch);
                        pthread_exit((void*)FAILURE);
                     }
-                    last_packet = DATA;
-                    last_packet_seq = fileinfo.seq;
-                    state = 2;
-                    break;
-                }
-                case 2: // send connect num to server.
-                {
-                    mftp_packet connect_num;
-                    sprintf(connect_num.data, "%d", targ.cnum);
-                    connect_num.flag = DATA;
-                    connect_num.seq = seqnum++;
-                    last_p = connect_num;
-                    DEBUGF("Thread %d Connect num being sent: %s.\n", targ.validipnum, connect_num.data);
-                    int wc = send_dgram(clisock, &servinfo, slen, connect_num);
-                    if (wc == FALSE) {
-                       fprintf(stderr, "Error: sendto()) error.\n");
+                    // a small file comes whole on chunk 0's connection,
+                    // the others only learn it.
+                    int whole = (sdata.opts & OPT_INLINE) != 0;
+                    int current = announce_file(&meta, whole && targ.validipnum == 0);
+                    if (current < 0) {
                        close(clisock);
+                       free(window);
+                       write_behind_free(&wb);
+                       batch_destroy(batch);
+                       free(batch);
                        pthread_exit((void*)FAILURE);
                     }
-                    last_packet = DATA;
-                    last_packet_seq = connect_num.seq;
-                    state = 3; 
-                    break;
-                }
-                case 3: // send starting point of the file
-                {
-                    mftp_packet offset;
-                    sprintf(offset.data, "%d", targ.validipnum);
-                    offset.flag = DATA;
-                    offset.seq = seqnum++;
-                    last_p = offset;
-                    DEBUGF("Thread: %d Connect num being sent: %s.\n", targ.validipnum, offset.data);
-                    int wc = send_dgram(clisock, &servinfo, slen, offset);
-                    if (wc == FALSE) {
-                       fprintf(stderr, "Error: sendto()) error.\n");
+                    if (current > 0) {
+                       // tell the server to drop the connection, nothing to send.
+                       DEBUGF("Thread %d local copy matches or came whole, skipping chunk.\n", targ.validipnum);
+                       chunklen = 0;
+                       if (!whole) {
+                          send_frame(clisock, &servinfo, slen, DONE, 0, conn, seqnum++, NULL, 0);
+                          controls++;
+                       }
+                       state = 6;
+                       break;
+                    }
+                    // the range must be the one planned from the announced
+                    // size, or the whole file when it comes inline.
+                    long long planned = announced.size / targ.cnum * targ.validipnum;
+                    long long plannedlen = targ.validipnum == targ.cnum - 1
+                                         ? announced.size - planned : announced.size / targ.cnum;
+                    if (whole) {
+                       planned = 0;
+                       plannedlen = targ.validipnum == 0 ? announced.size : 0;
+                    }
+                    if (woffset != planned || chunklen != plannedlen) {
+                       fprintf(stderr, "Error: server sent no valid range for chunk %d.\n", targ.validipnum);
                        close(clisock);
+                       free(window);
+                       write_behind_free(&wb);
+                       batch_destroy(batch);
+                       free(batch);
                        pthread_exit((void*)FAILURE);
                     }
-                    last_packet = DATA;
-                    last_packet_seq = offset.seq;
-                    state = 4; 
-                    break;
-                }
-                case 4: 
-                {
-                    last_packet_seq = seqnum++;
-                    file_seq_num = last_packet_seq;
-                    send_ack(seqnum, clisock, servinfo, slen);
-                    last_packet = ACK;
+                    DEBUGF("Thread %d chunk is %lld bytes at %lld.\n", targ.validipnum, chunklen, woffset);
+                    if (whole) {
+                       // the server kept no session, so nothing is acked
+                       // and the request is what goes again on a timeout.
+                       DEBUGF("Thread %d file comes whole, %lld bytes.\n", targ.validipnum, chunklen);
+                       inline_data = TRUE;
+                       state = chunklen == 0 ? 6 : 5;
+                       break;
+                    }
+                    if (map_output && chunklen > 0) {
+                       // the file already has its announced size.
+                       outmap = map_file_range(outfd, woffset, chunklen, &chunkdata, &outmaplen);
+                       if (outmap == NULL) {
+                          fprintf(stderr, "Error: could not map chunk %d of the file.\n", targ.validipnum);
+                          close(clisock);
+                          free(window);
+                          write_behind_free(&wb);
+                          batch_destroy(batch);
+                          free(batch);
+                          pthread_exit((void*)FAILURE);
+                       }
+                    }
+
+                    // the data is already on its way, the START only
+                    // lets the server take acks. Frames lost on the way
+                    // come again when the server's retransmit timer runs out.
+                    last_p.flag = START;
+                    last_p.seq = seqnum++;
+                    last_p.len = 0;
+                    last_packet = START;
                     state = 5;
                     break;
                 }
-                case 5: // receive data send next ack.
+                case 5: // receive data, write it in order and ack the batch.
                 {
-                    if (sdata.flag == DATA) {
-                        char buffer[64];
-                        sprintf(buffer, "%d", targ.validipnum);
-                        FILE *newfile = NULL;
-                        if (file_seq_num == last_packet_seq) {
-                            newfile = fopen(buffer, "w+");
-                        } else {
-                            newfile = fopen(buffer, "a");
+                    long long at = (long long)sdata.seq * SEGMENT_SIZE;
+                    if (sdata.flag == DATA && at >= chunklen) {
+                        // no segment of the chunk starts there.
+                        fprintf(stderr, "Error: segment %u is past the end of chunk %d.\n",
+                                sdata.seq, targ.validipnum);
+                        exitstatus = FAILURE;
+                        breakloop = 1;
+                        state = 6;
+                    } else if (sdata.flag == DATA && (at + sdata.len > chunklen
+                        || (sdata.len != SEGMENT_SIZE && at + sdata.len != chunklen))) {
+                        // only the last segment may be short, the file
+                        // shrank on the server after it was announced.
+                        fprintf(stderr, "Error: chunk %d is shorter than announced.\n", targ.validipnum);
+                        exitstatus = FAILURE;
+                        breakloop = 1;
+                        state = 6;
+                    } else if (sdata.flag == DATA && outmap != NULL) {
+                        // every segment is copied to its place in the
+                        // mapping as it comes, in order or not.
+                        memcpy(chunkdata + at, sdata.data, sdata.len);
+                        unsigned int base = window->base;
+                        recv_window_mark(window, sdata.seq);
+                        // out of order, a duplicate, or the end of a gap.
+                        int gap = sdata.seq != base || window->base > base + 1;
+                        if (ack_policy_data(&acks, last_heard, gap)) {
+                            ack_due = 1;
+                        }
+                        ack_opts = sdata.opts & OPT_TS;
+                        ack_ts = sdata.ts;
+                    } else if (sdata.flag == DATA) {
+                        // an in order segment is written straight out of
+                        // the receive buffer, others wait in the window.
+                        unsigned int base = window->base;
+                        int in_order = recv_window_in_order(window, sdata.seq);
+                        if (!in_order) {
+                            recv_window_store(window, sdata.seq, sdata.data, sdata.len);
+                        }
+
+                        char *data = NULL;
+                        int len = 0;
+                        while (in_order || recv_window_next(window, &data, &len)) {
+                            if (in_order) {
+                                data = (char *)sdata.data;
+                                len = sdata.len;
+                                recv_window_skip(window);
+                                in_order = 0;
+                            }
+                            if (!write_behind_add(&wb, woffset, data, len)) {
+                               fprintf(stderr, "Error: write of chunk %d failed.\n", targ.validipnum);
+                               close(clisock);
+                               free(window);
+                               write_behind_free(&wb);
+                               batch_destroy(batch);
+                               free(batch);
+                               pthread_exit((void*)FAILURE);
+                            }
+                            woffset += len;
                         }
-                        if (newfile == NULL) {
-                           fprintf(stderr, "Error: Opening of file: %s failed.\n", buffer);
-                           close(clisock);
-                           pthread_exit((void*)FAILURE);
-                        } else {
-                           DEBUGF("Thread %d File %s opened.\n", targ.validipnum, buffer);
+                        if (!inline_data) {
+                            // duplicates are acked too, the last ack may
+                            // have been lost. A gap is acked at once.
+                            int gap = sdata.seq != base || window->base > base + 1;
+                            if (ack_policy_data(&acks, last_heard, gap)) {
+                                ack_due = 1;
+                            }
+                            ack_opts = sdata.opts & OPT_TS;
+                            ack_ts = sdata.ts;
                         }
-                        int wc = write(fileno(newfile), sdata.data, strlen(sdata.data));
-                        if (wc < 0) {
-                           fprintf(stderr, "Error: write(2) error when write to file: %s.\n", buffer);
-                           fclose(newfile);
-                           close(clisock);
-                           pthread_exit((void*)FAILURE);
+                        if (inline_data && woffset == chunklen) {
+                            DEBUGF("Thread %d received the whole file.\n", targ.validipnum);
+                            if (!write_behind_flush(&wb)) {
+                                exitstatus = FAILURE;
+                            }
+                            state = 6;
+                        }
+                    } else if (sdata.flag == DONE) {
+                        DEBUGF("Thread %d received all %u segments.\n", targ.validipnum, window->base);
+                        if (!write_behind_flush(&wb)) {
+                            exitstatus = FAILURE;
                         }
-                        fclose(newfile);
-                        last_packet_seq = seqnum++;
-                        send_ack(seqnum, clisock, servinfo, slen);
-                    } else {
                         state = 6;
                     }
                     break;
@@ -521,19 +789,37 @@ void *thread_get_chunk(void *arg) {
                     break;
               }
           }
+          if (ack_due && state == 5) {
+              // one ack names every segment we hold, and echoes the
+              // stamp of the newest one.
+              batch_queue_sack(batch, &servinfo, slen, conn, window, ack_opts, ack_ts);
+              ack_policy_sent(&acks);
+              last_packet = ACK;
+          }
+          ack_due = 0;
+       } else if (ack_timer) {
+          // the held ack is due, the connection is not quiet.
+          if (state == 5) {
+              batch_queue_sack(batch, &servinfo, slen, conn, window, ack_opts, ack_ts);
+          }
+          ack_policy_sent(&acks);
        } else {
           // handle timeout
-          // retransmit last packet.
-          connection_timeouts++;
-          if (connection_timeouts > 5) {
+          // retransmit last packet, and wait twice as long for the next.
+          rtt_backoff(&rtt);
+          if (current_time_usec() - last_heard >= SERVER_TIMEOUT) {
               breakloop = 1;
               exitstatus = FAILURE;
           }
+          if (last_packet == REQ) {
+              requests++;
+          }
           if (last_packet == ACK) {
-             // retransmit ack
-             send_ack(seqnum, clisock, servinfo, slen);
+             // what we hold now, in case the last ack was lost.
+             batch_queue_sack(batch, &servinfo, slen, conn, window, 0, 0);
           } else {
               int wc = send_dgram(clisock, &servinfo, slen, last_p);
+              controls++;
               if (wc == 0) {
                   fprintf(stderr, "Error: sendto()) error.\n");
               } else {
@@ -541,11 +827,34 @@ void *thread_get_chunk(void *arg) {
               }
           }
        }
+       batch_flush(batch);
        if (breakloop) {
            break;
        }
    }
    close(clisock);  
+   char who[64];
+   sprintf(who, "Thread %d", targ.validipnum);
+   print_batch_stats(batch, who);
+   printf("%s: srtt %lld us, rto %lld us, %lu timeouts\n", who, rtt.srtt, rtt.rto, rtt.backoffs);
+   printf("%s: %lu acks, %lu of them at once for a gap\n", who, acks.acks, acks.immediate);
+   pthread_mutex_lock(&stats_lock);
+   reverse_packets += controls + batch->send_frames;
+   if (!up_to_date) {
+       received_bytes += chunklen;
+   }
+   pthread_mutex_unlock(&stats_lock);
+   if (outmap != NULL) {
+       printf("%s: %lld bytes copied into the mapped file\n", who, chunklen);
+   } else {
+       printf("%s: %lu writes of up to %d bytes\n", who, wb.writes, wb.size > 0 ? wb.size : SEGMENT_SIZE);
+   }
+   free(window);
+   write_behind_free(&wb);
+   // the pages are in the page cache, the file is complete without msync.
+   unmap_file(outmap, outmaplen);
+   batch_destroy(batch);
+   free(batch);
    if (FAILURE == exitstatus) {
        pthread_exit((void*)FAILURE);
    } else {
@@ -553,6 +862,62 @@ void *thread_get_chunk(void *arg) {
    }
 }
 
+static int announce_file(const struct file_meta *m, int whole) {
+   pthread_mutex_lock(&announce_lock);
+   int result = 0;
+   if (have_announced) {
+      // checksum 0 is a file the server has not hashed yet, the first
+      // connections may see it before the later ones.
+      if (m->size != announced.size || m->mtime != announced.mtime
+          || (m->checksum != 0 && announced.checksum != 0 && m->checksum != announced.checksum)) {
+         fprintf(stderr, "Error: the file changed on the server during the transfer.\n");
+         result = -1;
+      } else {
+         // a small file, chunk 0's connection brings all of it.
+         result = up_to_date || whole_file;
+      }
+   } else {
+      announced = *m;
+      have_announced = TRUE;
+      whole_file = whole;
+      // checksum 0 means the server has not hashed the file yet. A
+      // finished copy has the server's mtime, anything else is not worth
+      // reading the whole file for.
+      if (m->checksum != 0 && local.size == m->size && local.mtime == m->mtime) {
+         local.checksum = file_checksum(outfd, local.size);
+      }
+      if (m->checksum != 0 && local.size == m->size && local.mtime == m->mtime
+          && local.checksum == m->checksum) {
+         up_to_date = TRUE;
+         result = 1;
+      } else {
+         // no thread writes before this, so cutting an old copy is safe.
+         // reserving the blocks keeps the file from fragmenting.
+         if (ftruncate(outfd, m->size) < 0) {
+            fprintf(stderr, "Error: could not size the file to %lld bytes: %s.\n", m->size, strerror(errno));
+            result = -1;
+         } else if (m->size > 0 && fallocate(outfd, 0, 0, m->size) < 0) {
+            DEBUGF("fallocate() failed: %s.\n", strerror(errno));
+         }
+      }
+   }
+   pthread_mutex_unlock(&announce_lock);
+   return result;
+}
+
+static int came_whole(void) {
+   pthread_mutex_lock(&announce_lock);
+   int whole = have_announced && whole_file;
+   pthread_mutex_unlock(&announce_lock);
+   return whole;
+}
+
+static void payload_text(const mftp_view *p, char *buf, int size) {
+   int len = p->len < size - 1 ? p->len : size - 1;
+   memcpy(buf, p->data, len);
+   buf[len] = '\0';
+}
+
 void check_error(char *x, char *y) {
    if (strcmp(x, y) == 0) {
       fprintf(stderr, "Error: server send an error. Exiting.\n");
@@ -0,0 +1,296 @@
+// File: congestion.c
+// Created October 17, 2026
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+// comment this out to turn on debug prints.
+//#define NDEBUG NDEBUG
+
+#include "congestion.h"
+#include "utils.h"
+
+// Reno: slow start, one segment more per round trip, halve on loss.
+static void reno_ack(cc_state *c, unsigned int acked, long long now);
+static void reno_loss(cc_state *c, int timeout, long long now);
+
+// CUBIC as in RFC 8312: the window grows along a cubic of the time
+// since the last cut, centered on the window the cut was made at.
+static void cubic_init(cc_state *c);
+static void cubic_ack(cc_state *c, unsigned int acked, long long now);
+static void cubic_loss(cc_state *c, int timeout, long long now);
+static void cubic_rtt_sample(cc_state *c, long long rtt, long long now);
+
+// BBR-like: the window follows a model of the path, the most recent
+// rounds' best delivery rate times the minimum rtt, not the losses.
+static void bbr_init(cc_state *c);
+static void bbr_ack(cc_state *c, unsigned int acked, long long now);
+static void bbr_loss(cc_state *c, int timeout, long long now);
+static void bbr_rtt_sample(cc_state *c, long long rtt, long long now);
+
+// sets the BBR window from the model and the mode.
+static void bbr_set_window(cc_state *c);
+
+// CUBIC constants from RFC 8312.
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+
+// BBR modes.
+#define BBR_STARTUP 0
+#define BBR_DRAIN 1
+#define BBR_PROBE 2
+
+// without pacing the window holds twice the model, as BBR's cwnd gain.
+#define BBR_CWND_GAIN 2.0
+
+// phases of the probe cycle: one round above the model, one below.
+static const double bbr_gains[8] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+
+static const cc_ops controllers[] = {
+    {"reno", NULL, reno_ack, reno_loss, NULL},
+    {"cubic", cubic_init, cubic_ack, cubic_loss, cubic_rtt_sample},
+    {"bbr", bbr_init, bbr_ack, bbr_loss, bbr_rtt_sample},
+    {"fixed", NULL, NULL, NULL, NULL},
+};
+
+const cc_ops *cc_find(const char *name) {
+    for (size_t i = 0; i < sizeof(controllers) / sizeof(controllers[0]); ++i) {
+        if (strcmp(controllers[i].name, name) == 0) {
+            return &controllers[i];
+        }
+    }
+    return NULL;
+}
+
+void cc_init(cc_state *c, const cc_ops *ops, unsigned int limit) {
+    memset(c, 0, sizeof(*c));
+    c->ops = ops;
+    c->limit = limit < 1 ? 1 : limit;
+    c->ssthresh = c->limit;
+    if (ops->on_ack == NULL) {
+        // nothing would grow it, so it starts at the limit.
+        c->cwnd = c->limit;
+    } else {
+        c->cwnd = CC_INITIAL_WINDOW;
+    }
+    if (ops->init != NULL) {
+        ops->init(c);
+    }
+}
+
+void cc_ack(cc_state *c, unsigned int acked, long long now) {
+    if (c->ops->on_ack == NULL || acked == 0) {
+        return;
+    }
+    c->ops->on_ack(c, acked, now);
+    // a window the connection can not use would only grow without limit.
+    if (c->cwnd > c->limit) {
+        c->cwnd = c->limit;
+    }
+}
+
+void cc_loss(cc_state *c, int timeout, long long now) {
+    if (c->ops->on_loss == NULL) {
+        return;
+    }
+    if (!timeout && now < c->recovery) {
+        return;
+    }
+    c->recovery = now + c->srtt;
+    double before = c->cwnd;
+    c->ops->on_loss(c, timeout, now);
+    if (c->cwnd < before) {
+        c->reductions++;
+    }
+    DEBUGF("%s: loss%s, cwnd %.1f ssthresh %.1f\n", c->ops->name,
+           timeout ? " by timeout" : "", c->cwnd, c->ssthresh);
+}
+
+void cc_rtt_sample(cc_state *c, long long rtt, long long now) {
+    if (rtt < 1) rtt = 1;
+    c->srtt = c->srtt == 0 ? rtt : c->srtt + (rtt - c->srtt) / 8;
+    if (c->ops->on_rtt_sample != NULL) {
+        c->ops->on_rtt_sample(c, rtt, now);
+    }
+}
+
+unsigned int cc_window(const cc_state *c) {
+    if (c->cwnd < 1) return 1;
+    if (c->cwnd > c->limit) return c->limit;
+    return (unsigned int)c->cwnd;
+}
+
+static void reno_ack(cc_state *c, unsigned int acked, long long now) {
+    (void)now;
+    if (c->cwnd < c->ssthresh) {
+        c->cwnd += acked;
+    } else {
+        c->cwnd += (double)acked / c->cwnd;
+    }
+}
+
+static void reno_loss(cc_state *c, int timeout, long long now) {
+    (void)now;
+    c->ssthresh = c->cwnd / 2;
+    if (c->ssthresh < CC_MIN_WINDOW) c->ssthresh = CC_MIN_WINDOW;
+    c->cwnd = timeout ? 1 : c->ssthresh;
+}
+
+static void cubic_init(cc_state *c) {
+    c->u.cubic.w_max = c->limit;
+}
+
+static void cubic_ack(cc_state *c, unsigned int acked, long long now) {
+    if (c->cwnd < c->ssthresh) {
+        c->cwnd += acked;
+        return;
+    }
+    if (c->u.cubic.epoch == 0) {
+        c->u.cubic.epoch = now;
+        if (c->cwnd < c->u.cubic.w_max) {
+            c->u.cubic.k = cbrt((c->u.cubic.w_max - c->cwnd) / CUBIC_C);
+        } else {
+            c->u.cubic.k = 0;
+            c->u.cubic.w_max = c->cwnd;
+        }
+        c->u.cubic.w_est = c->cwnd;
+    }
+    // where the cubic will be one round trip from now.
+    double t = (now - c->u.cubic.epoch + c->u.cubic.delay_min) / 1e6;
+    double target = CUBIC_C * pow(t - c->u.cubic.k, 3) + c->u.cubic.w_max;
+    // never slower than Reno would be on the same path.
+    c->u.cubic.w_est += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * acked / c->cwnd;
+    if (target < c->u.cubic.w_est) {
+        target = c->u.cubic.w_est;
+    }
+    if (target > 1.5 * c->cwnd) {
+        target = 1.5 * c->cwnd;
+    }
+    if (target > c->cwnd) {
+        c->cwnd += (target - c->cwnd) / c->cwnd * acked;
+    }
+}
+
+static void cubic_loss(cc_state *c, int timeout, long long now) {
+    (void)now;
+    c->u.cubic.epoch = 0;
+    // fast convergence: give up more room if the last peak was not reached.
+    if (c->cwnd < c->u.cubic.w_max) {
+        c->u.cubic.w_max = c->cwnd * (1 + CUBIC_BETA) / 2;
+    } else {
+        c->u.cubic.w_max = c->cwnd;
+    }
+    c->ssthresh = c->cwnd * CUBIC_BETA;
+    if (c->ssthresh < CC_MIN_WINDOW) c->ssthresh = CC_MIN_WINDOW;
+    c->cwnd = timeout ? 1 : c->ssthresh;
+}
+
+static void cubic_rtt_sample(cc_state *c, long long rtt, long long now) {
+    (void)now;
+    if (c->u.cubic.delay_min == 0 || rtt < c->u.cubic.delay_min) {
+        c->u.cubic.delay_min = rtt;
+    }
+}
+
+static void bbr_init(cc_state *c) {
+    c->u.bbr.mode = BBR_STARTUP;
+}
+
+static void bbr_ack(cc_state *c, unsigned int acked, long long now) {
+    if (c->u.bbr.prior_cwnd > 0) {
+        // acks flow again, the model still holds.
+        if (c->cwnd < c->u.bbr.prior_cwnd) {
+            c->cwnd = c->u.bbr.prior_cwnd;
+        }
+        c->u.bbr.prior_cwnd = 0;
+    }
+    c->u.bbr.delivered += acked;
+    if (acked > c->u.bbr.aggregate) {
+        c->u.bbr.aggregate = acked;
+    }
+    if (c->u.bbr.mode == BBR_STARTUP) {
+        // doubles each round, as slow start, until the rate stops growing.
+        c->cwnd += acked;
+    }
+    if (c->u.bbr.round_start == 0) {
+        c->u.bbr.round_start = now;
+        return;
+    }
+    // a round lasts a smoothed rtt, long enough to average out acks
+    // the client held back.
+    long long elapsed = now - c->u.bbr.round_start;
+    if (c->u.bbr.min_rtt == 0 || elapsed < c->srtt) {
+        return;
+    }
+    // a round is over: its delivery rate is a bandwidth sample.
+    c->u.bbr.bw[c->u.bbr.round % CC_BW_ROUNDS] = (double)c->u.bbr.delivered / elapsed;
+    c->u.bbr.round++;
+    c->u.bbr.delivered = 0;
+    c->u.bbr.round_start = now;
+    c->u.bbr.btlbw = 0;
+    for (int i = 0; i < CC_BW_ROUNDS; ++i) {
+        if (c->u.bbr.bw[i] > c->u.bbr.btlbw) {
+            c->u.bbr.btlbw = c->u.bbr.bw[i];
+        }
+    }
+    switch (c->u.bbr.mode) {
+        case BBR_STARTUP:
+            // three rounds without a quarter more bandwidth fill the pipe.
+            if (c->u.bbr.btlbw >= c->u.bbr.full_bw * 1.25) {
+                c->u.bbr.full_bw = c->u.bbr.btlbw;
+                c->u.bbr.full_rounds = 0;
+            } else if (++c->u.bbr.full_rounds >= 3) {
+                c->u.bbr.mode = BBR_DRAIN;
+            }
+            break;
+        case BBR_DRAIN:
+            // one round at the model empties the queue startup built.
+            c->u.bbr.mode = BBR_PROBE;
+            c->u.bbr.cycle = 0;
+            break;
+        default:
+            c->u.bbr.cycle = (c->u.bbr.cycle + 1) % 8;
+            break;
+    }
+    bbr_set_window(c);
+}
+
+static void bbr_loss(cc_state *c, int timeout, long long now) {
+    (void)now;
+    if (timeout) {
+        // only the resends go out until an ack shows the path works,
+        // then the window from before comes back.
+        if (c->u.bbr.prior_cwnd < c->cwnd) {
+            c->u.bbr.prior_cwnd = c->cwnd;
+        }
+        c->cwnd = CC_MIN_WINDOW;
+    } else if (c->u.bbr.mode == BBR_STARTUP) {
+        // the pipe overflowed before the rate stopped growing.
+        c->u.bbr.mode = BBR_DRAIN;
+    }
+    // losses alone do not change the model.
+}
+
+static void bbr_rtt_sample(cc_state *c, long long rtt, long long now) {
+    if (c->u.bbr.min_rtt == 0 || rtt <= c->u.bbr.min_rtt
+        || now - c->u.bbr.min_rtt_stamp > CC_MIN_RTT_WINDOW) {
+        c->u.bbr.min_rtt = rtt;
+        c->u.bbr.min_rtt_stamp = now;
+    }
+}
+
+static void bbr_set_window(cc_state *c) {
+    if (c->u.bbr.mode == BBR_STARTUP) {
+        return;
+    }
+    double bdp = c->u.bbr.btlbw * c->u.bbr.min_rtt;
+    double gain = c->u.bbr.mode == BBR_DRAIN ? 1 : BBR_CWND_GAIN * bbr_gains[c->u.bbr.cycle];
+    // room for the segments a delayed ack covers, or the window would
+    // wait on the client's ack timer every round.
+    c->cwnd = gain * bdp + c->u.bbr.aggregate;
+    if (c->cwnd < 2 * CC_MIN_WINDOW) {
+        c->cwnd = 2 * CC_MIN_WINDOW;
+    }
+}
@@ -0,0 +1,154 @@
+// File: congestion.h
+// Created October 17, 2026
+
+#ifndef __CONGESTION_H__
+#define __CONGESTION_H__
+
+/**
+ * @file congestion.h
+ * Congestion control for the send window. A controller keeps a
+ * congestion window in segments from the events of a connection: new
+ * acks, losses and round trip samples. The session sends no more new
+ * segments than the window allows, up to the connection's window size,
+ * so connections sharing a path back off from each other instead of
+ * all sending their full window into it. Controllers are a table of
+ * hooks, chosen by name per server.
+ */
+
+/**
+ * Controller used when the server is given none.
+ */
+#define CC_DEFAULT "cubic"
+
+/**
+ * Congestion window a connection starts with, as in RFC 6928.
+ */
+#define CC_INITIAL_WINDOW 10
+
+/**
+ * Smallest window left after a loss that was not a timeout.
+ */
+#define CC_MIN_WINDOW 2
+
+/**
+ * Rounds a BBR-style controller keeps delivery rates for.
+ */
+#define CC_BW_ROUNDS 10
+
+/**
+ * How long a BBR-style controller trusts its minimum rtt, in usec.
+ */
+#define CC_MIN_RTT_WINDOW 10000000LL
+
+typedef struct cc_state cc_state;
+
+/**
+ * The hooks of one controller. Any hook may be NULL.
+ */
+typedef struct cc_ops {
+    const char *name;
+    // sets up the controller's own state, cwnd and ssthresh are set.
+    void (*init)(cc_state *c);
+    // acked segments were newly acknowledged.
+    void (*on_ack)(cc_state *c, unsigned int acked, long long now);
+    // a loss was found, by a timeout or by later acks. Called once per
+    // loss episode unless it is a timeout.
+    void (*on_loss)(cc_state *c, int timeout, long long now);
+    // a round trip was measured.
+    void (*on_rtt_sample)(cc_state *c, long long rtt, long long now);
+} cc_ops;
+
+/**
+ * Congestion state of one connection.
+ */
+struct cc_state {
+    const cc_ops *ops;              // the controller.
+    double cwnd;                    // segments allowed in flight.
+    double ssthresh;                // slow start ends at this window.
+    unsigned int limit;             // the connection's window size, cwnd never passes it.
+    long long srtt;                 // smoothed round trip time, 0 before a sample.
+    long long recovery;             // losses before this time belong to the last episode.
+    unsigned long reductions;       // times a loss cut the window.
+    union {
+        struct {
+            double w_max;           // window before the last cut.
+            double k;               // seconds until the cubic is back at w_max.
+            double w_est;           // what Reno would have by now.
+            long long epoch;        // start of the growth period, 0 after a cut.
+            long long delay_min;    // smallest rtt seen.
+        } cubic;
+        struct {
+            int mode;               // startup, drain or probe.
+            double btlbw;           // bottleneck bandwidth, segments per usec.
+            double bw[CC_BW_ROUNDS];    // delivery rate of the last rounds.
+            unsigned int round;     // rounds so far.
+            long long round_start;  // when the current round began.
+            unsigned int delivered; // segments acked in the current round.
+            double full_bw;         // bandwidth startup last grew to.
+            int full_rounds;        // rounds since it grew by a quarter.
+            int cycle;              // phase of the probe gain cycle.
+            double prior_cwnd;      // window before a timeout, 0 if none.
+            unsigned int aggregate; // most segments one ack has covered.
+            long long min_rtt;      // smallest rtt in the last CC_MIN_RTT_WINDOW.
+            long long min_rtt_stamp;    // when it was taken.
+        } bbr;
+    } u;
+};
+
+/**
+ * Finds a controller by name: "reno", "cubic", "bbr" or "fixed", which
+ * keeps the window at its limit.
+ *
+ * @param name The controller's name.
+ *
+ * @return The controller, or NULL if there is none by that name.
+ */
+const cc_ops *cc_find(const char *name);
+
+/**
+ * Starts a connection's congestion state with the initial window.
+ *
+ * @param c The state.
+ * @param ops The controller.
+ * @param limit The connection's window size.
+ */
+void cc_init(cc_state *c, const cc_ops *ops, unsigned int limit);
+
+/**
+ * Reports newly acknowledged segments.
+ *
+ * @param c The state.
+ * @param acked Segments the ack covered for the first time.
+ * @param now The current time in microseconds.
+ */
+void cc_ack(cc_state *c, unsigned int acked, long long now);
+
+/**
+ * Reports a loss. Losses found by later acks within one round trip of
+ * the last cut are one episode and cut the window once.
+ *
+ * @param c The state.
+ * @param timeout 1 if a retransmission timer ran out.
+ * @param now The current time in microseconds.
+ */
+void cc_loss(cc_state *c, int timeout, long long now);
+
+/**
+ * Reports a round trip sample.
+ *
+ * @param c The state.
+ * @param rtt The round trip time in microseconds.
+ * @param now The current time in microseconds.
+ */
+void cc_rtt_sample(cc_state *c, long long rtt, long long now);
+
+/**
+ * The send window the controller allows now.
+ *
+ * @param c The state.
+ *
+ * @return Segments allowed in flight, 1 to the limit.
+ */
+unsigned int cc_window(const cc_state *c);
+
+#endif
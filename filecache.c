@@ -0,0 +1,253 @@
+// File: filecache.c
+// Created October 17, 2026
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// comment this out to turn on debug prints.
+//#define NDEBUG NDEBUG
+
+#include "filecache.h"
+#include "utils.h"
+
+// FNV-1a over the file name.
+static unsigned int name_hash(const char *name);
+
+// finds the entry for name in the table, NULL if there is none.
+static cached_file *cache_find(file_cache *c, const char *name);
+
+// takes an entry out of the table and the LRU list.
+static void cache_unlink(file_cache *c, cached_file *f);
+
+// makes f the most recently used entry.
+static void cache_touch(file_cache *c, cached_file *f);
+
+// unmaps, closes and frees an entry.
+static void cache_close(cached_file *f);
+
+int file_cache_init(file_cache *c, catalog *files, unsigned int capacity, int map) {
+    memset(c, 0, sizeof(*c));
+    c->files = files;
+    if (capacity < 1) capacity = 1;
+    c->capacity = capacity;
+    c->map = map;
+    // twice the capacity in buckets keeps the chains short.
+    c->mask = 15;
+    while (c->mask + 1 < 2 * capacity) {
+        c->mask = c->mask * 2 + 1;
+    }
+    c->buckets = calloc(c->mask + 1, sizeof(cached_file *));
+    if (c->buckets == NULL) {
+        fprintf(stderr, "Error: calloc() of file cache failed.\n");
+        return 0;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    return 1;
+}
+
+cached_file *file_cache_open(file_cache *c, const char *name, uint32_t *checksum) {
+    // the catalog tells whether a cached descriptor still is the file on disk.
+    catalog_entry meta;
+    if (!catalog_lookup(c->files, name, &meta)) {
+        fprintf(stderr, "Error: no file matching %s exists in current directory.\n", name);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    cached_file *f = cache_find(c, name);
+    if (f != NULL) {
+        if (meta.ino == f->ino && meta.size == f->size && meta.mtime == f->mtime) {
+            if (f->checksum == 0) {
+                // the catalog thread may have finished it since.
+                f->checksum = meta.checksum;
+            }
+            *checksum = f->checksum;
+            f->refs++;
+            c->hits++;
+            cache_touch(c, f);
+            pthread_mutex_unlock(&c->lock);
+            return f;
+        }
+        DEBUGF("File: %s changed on disk, dropping it from the cache.\n", name);
+        cache_unlink(c, f);
+        if (f->refs == 0) {
+            cache_close(f);
+        } else {
+            f->stale = 1;
+        }
+    }
+    c->misses++;
+    pthread_mutex_unlock(&c->lock);
+
+    // open outside the lock, other workers keep hitting the cache.
+    FILE *stream = fopen(name, "r");
+    if (stream == NULL) {
+        fprintf(stderr, "Error: fopen() of %s failed: %s.\n", name, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fileno(stream), &st) < 0) {
+        perror("Error: fstat() of requested file failed ");
+        fclose(stream);
+        return NULL;
+    }
+    f = malloc(sizeof(cached_file));
+    if (f == NULL) {
+        fprintf(stderr, "Error: malloc() of cached file failed.\n");
+        fclose(stream);
+        return NULL;
+    }
+    memset(f, 0, sizeof(*f));
+    snprintf(f->name, sizeof(f->name), "%s", name);
+    f->stream = stream;
+    f->fd = fileno(stream);
+    f->size = st.st_size;
+    f->mtime = st.st_mtime;
+    f->ino = st.st_ino;
+    if (meta.ino == f->ino && meta.size == f->size && meta.mtime == f->mtime) {
+        f->checksum = meta.checksum;
+    }
+    if (f->checksum == 0) {
+        // reading the whole file would stall the worker, the catalog
+        // thread does it and later opens pick the checksum up.
+        catalog_want_checksum(c->files, name);
+    }
+    if (c->map) {
+        f->map = map_file(f->fd, &f->maplen);
+    }
+    f->refs = 1;
+
+    pthread_mutex_lock(&c->lock);
+    cached_file *other = cache_find(c, name);
+    if (other != NULL && other->ino == f->ino && other->size == f->size
+        && other->mtime == f->mtime) {
+        // another worker opened it meanwhile, share that one.
+        if (other->checksum == 0) {
+            other->checksum = f->checksum;
+        }
+        *checksum = other->checksum;
+        other->refs++;
+        cache_touch(c, other);
+        pthread_mutex_unlock(&c->lock);
+        cache_close(f);
+        return other;
+    }
+    if (other != NULL) {
+        cache_unlink(c, other);
+        if (other->refs == 0) {
+            cache_close(other);
+        } else {
+            other->stale = 1;
+        }
+    }
+    // make room by closing the least recently used files nobody reads.
+    cached_file *victim = c->tail;
+    while (c->count >= c->capacity && victim != NULL) {
+        cached_file *prev = victim->prev;
+        if (victim->refs == 0) {
+            DEBUGF("File: %s evicted from the cache.\n", victim->name);
+            cache_unlink(c, victim);
+            cache_close(victim);
+            c->evictions++;
+        }
+        victim = prev;
+    }
+    unsigned int b = name_hash(name) & c->mask;
+    f->hnext = c->buckets[b];
+    c->buckets[b] = f;
+    c->count++;
+    cache_touch(c, f);
+    *checksum = f->checksum;
+    pthread_mutex_unlock(&c->lock);
+    DEBUGF("File: %s opened, %lld bytes.\n", name, f->size);
+    return f;
+}
+
+void file_cache_release(file_cache *c, cached_file *f) {
+    if (f == NULL) return;
+    pthread_mutex_lock(&c->lock);
+    f->refs--;
+    int close_it = f->stale && f->refs == 0;
+    pthread_mutex_unlock(&c->lock);
+    if (close_it) {
+        cache_close(f);
+    }
+}
+
+void file_cache_destroy(file_cache *c) {
+    cached_file *f = c->head;
+    while (f != NULL) {
+        cached_file *next = f->next;
+        cache_close(f);
+        f = next;
+    }
+    free(c->buckets);
+    c->buckets = NULL;
+    c->head = c->tail = NULL;
+    c->count = 0;
+    pthread_mutex_destroy(&c->lock);
+}
+
+void print_file_cache_stats(file_cache *c) {
+    pthread_mutex_lock(&c->lock);
+    printf("File cache: %lu hits %lu misses %lu evictions, %u files open\n",
+           c->hits, c->misses, c->evictions, c->count);
+    pthread_mutex_unlock(&c->lock);
+}
+
+static unsigned int name_hash(const char *name) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; ++p) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static cached_file *cache_find(file_cache *c, const char *name) {
+    cached_file *f = c->buckets[name_hash(name) & c->mask];
+    while (f != NULL && strcmp(f->name, name) != 0) {
+        f = f->hnext;
+    }
+    return f;
+}
+
+static void cache_unlink(file_cache *c, cached_file *f) {
+    cached_file **link = &c->buckets[name_hash(f->name) & c->mask];
+    while (*link != NULL && *link != f) {
+        link = &(*link)->hnext;
+    }
+    if (*link == f) {
+        *link = f->hnext;
+        c->count--;
+    }
+    f->hnext = NULL;
+    if (f->prev != NULL) f->prev->next = f->next;
+    else if (c->head == f) c->head = f->next;
+    if (f->next != NULL) f->next->prev = f->prev;
+    else if (c->tail == f) c->tail = f->prev;
+    f->prev = f->next = NULL;
+}
+
+static void cache_touch(file_cache *c, cached_file *f) {
+    if (c->head == f) return;
+    // out of its place in the list, if it has one.
+    if (f->prev != NULL) f->prev->next = f->next;
+    if (f->next != NULL) f->next->prev = f->prev;
+    else if (c->tail == f) c->tail = f->prev;
+    f->prev = NULL;
+    f->next = c->head;
+    if (c->head != NULL) c->head->prev = f;
+    c->head = f;
+    if (c->tail == NULL) c->tail = f;
+}
+
+static void cache_close(cached_file *f) {
+    unmap_file(f->map, f->maplen);
+    fclose(f->stream);
+    free(f);
+}
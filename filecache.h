@@ -0,0 +1,118 @@
+// File: filecache.h
+// Created October 17, 2026
+
+#ifndef __FILECACHE_H__
+#define __FILECACHE_H__
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "catalog.h"
+
+/**
+ * @file filecache.h
+ * Server wide cache of open files. Every connection of every client that
+ * asks for the same file shares one descriptor, its size and mtime, and
+ * with -m one read-only mapping, instead of opening the file itself.
+ * Names are resolved through the directory catalog. Entries are
+ * reference counted; unused ones stay open until the cache is full and
+ * they are the least recently used.
+ */
+
+/**
+ * Files kept open by default.
+ */
+#define FILE_CACHE_SIZE 64
+
+/**
+ * One open file. Everything but refs, checksum and the list links is
+ * fixed once the entry is created, so sessions read it without the
+ * lock. The checksum may arrive later and is only read under the lock,
+ * sessions get a copy from file_cache_open.
+ */
+typedef struct cached_file {
+    char name[256];                 // file name, the key.
+    FILE *stream;                   // the open file.
+    int fd;                         // fileno(stream).
+    long long size;                 // size when opened.
+    time_t mtime;                   // modification time when opened.
+    ino_t ino;                      // inode when opened.
+    uint32_t checksum;              // FNV-1a of the contents, 0 until the catalog has it.
+    const char *map;                // read-only mapping, or NULL.
+    size_t maplen;                  // length of map.
+    int refs;                       // sessions using the entry.
+    int stale;                      // out of the table, closed at refs 0.
+    struct cached_file *hnext;      // next entry in the same bucket.
+    struct cached_file *prev;       // more recently used entry.
+    struct cached_file *next;       // less recently used entry.
+} cached_file;
+
+/**
+ * The cache, shared by all workers.
+ */
+typedef struct file_cache {
+    pthread_mutex_t lock;
+    catalog *files;                 // the served directory.
+    cached_file **buckets;          // chains linked through hnext.
+    unsigned int mask;              // bucket count - 1, a power of two.
+    cached_file *head;              // most recently used entry.
+    cached_file *tail;              // least recently used entry.
+    unsigned int count;             // entries in the table.
+    unsigned int capacity;          // entries kept before evicting.
+    int map;                        // map files when they are opened.
+    unsigned long hits;             // lookups served from the cache.
+    unsigned long misses;           // lookups that opened the file.
+    unsigned long evictions;        // unused entries closed to make room.
+} file_cache;
+
+/**
+ * Sets up an empty cache.
+ *
+ * @param c The cache.
+ * @param files The catalog of the served directory.
+ * @param capacity Files to keep open, at least 1.
+ * @param map Nonzero to mmap files as they are opened.
+ *
+ * @return 1 on success, 0 if memory is short.
+ */
+int file_cache_init(file_cache *c, catalog *files, unsigned int capacity, int map);
+
+/**
+ * Looks a file up and takes a reference on it, opening it on a miss.
+ * Only files in the catalog are served. A cached entry is dropped and
+ * the file opened again if the catalog shows it was replaced or modified.
+ * A file without a checksum in the catalog is queued for the catalog
+ * thread to hash, never read here, and a later open picks it up.
+ *
+ * @param c The cache.
+ * @param name The file name.
+ * @param checksum Set to the file's checksum, 0 if it is not known yet.
+ *
+ * @return The entry, or NULL if there is no such file.
+ */
+cached_file *file_cache_open(file_cache *c, const char *name, uint32_t *checksum);
+
+/**
+ * Drops a reference taken by file_cache_open. Payloads pointing into the
+ * mapping must be sent before this is called.
+ *
+ * @param c The cache.
+ * @param f The entry, may be NULL.
+ */
+void file_cache_release(file_cache *c, cached_file *f);
+
+/**
+ * Closes every file. No references may be held.
+ *
+ * @param c The cache.
+ */
+void file_cache_destroy(file_cache *c);
+
+/**
+ * Prints the hit, miss and eviction counters.
+ *
+ * @param c The cache.
+ */
+void print_file_cache_stats(file_cache *c);
+
+#endif
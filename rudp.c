@@ -10,14 +10,20 @@
 #include <stdarg.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/random.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <poll.h>
 
 // comment this out to turn on debug prints.
 //#define NDEBUG NDEBUG
 
 #include "rudp.h"
 #include "utils.h"
+#include "uring.h"
 
 #define SUCCESS    0
 #define FAILURE    1
@@ -25,6 +31,28 @@
 #define TRUE  1
 #define FALSE 0
 
+// what a ring completion belongs to, kept in the top half of user_data.
+#define RING_RECV  1ULL
+#define RING_SEND  2ULL
+#define RING_READ  3ULL
+#define RING_WATCH 4ULL
+#define RING_TAG(kind, i) (((kind) << 32) | (unsigned long long)(i))
+
+// posts a recvmsg on the ring for receive slot i.
+static int batch_post_recv(rudp_batch *b, int i);
+
+// handles every completion waiting on the ring.
+static void batch_reap(rudp_batch *b);
+
+// waits until the ring is done with every payload buffer.
+static void batch_settle(rudp_batch *b);
+
+// splits received datagram i into frames.
+static void batch_split(rudp_batch *b, int i);
+
+// marks an outstanding segment acknowledged without sliding the window.
+static int send_window_mark(send_window *w, unsigned int seq);
+
 unsigned char *serialize_int(unsigned char *buffer, unsigned int val) {
     unsigned int size = sizeof(unsigned int);
     for (unsigned int i = 0; i < size; ++i) {
@@ -40,10 +68,25 @@ unsigned char *serialize_data(unsigned char *buffer, char buf[], int len) {
    return buffer + len;
 }
 
-unsigned char *serialize_packet(mftp_packet packet, unsigned char buffer[]) {
-    buffer = serialize_int(buffer, packet.seq);
-    buffer = serialize_data(buffer, packet.data, 1024);
-    buffer = serialize_int(buffer, packet.flag);
+unsigned char *serialize_short(unsigned char *buffer, unsigned short val) {
+    buffer[0] = val >> 8;
+    buffer[1] = val;
+    return buffer + 2;
+}
+
+unsigned char *serialize_header(unsigned char buffer[], unsigned int flag, unsigned char opts,
+                                unsigned int conn, unsigned int seq, unsigned int ts,
+                                unsigned short len) {
+    *buffer++ = MFTP_VERSION;
+    *buffer++ = (unsigned char)flag;
+    *buffer++ = opts;
+    *buffer++ = 0; // reserved.
+    buffer = serialize_int(buffer, conn);
+    buffer = serialize_int(buffer, seq);
+    buffer = serialize_short(buffer, len);
+    if (opts & OPT_TS) {
+        buffer = serialize_int(buffer, ts);
+    }
     return buffer;
 }
 
@@ -65,21 +108,19 @@ unsigned char *deserialize_data(unsigned char *buffer, char buf[], int len) {
 }
 
 
-mftp_packet deserialize_packet(unsigned char buffer[]) {
-    mftp_packet recv;
-    buffer = deserialize_int(buffer, &recv.seq); 
-    buffer = deserialize_data(buffer, recv.data, 1024);
-    buffer = deserialize_int(buffer, &recv.flag);
-    return recv;
+unsigned char *deserialize_short(unsigned char *buffer, unsigned short *val) {
+    *val = (unsigned short)((buffer[0] << 8) | buffer[1]);
+    return buffer + 2;
 }
 
-
-void send_error(int seq, int clisock, const struct sockaddr_in client, int clen) {
+void send_error(int seq, unsigned int conn, int clisock, const struct sockaddr_in client, int clen) {
    // send error.
    mftp_packet error;
+   error.conn = conn;
    error.seq = seq;
    error.flag = ERROR;
-   sprintf(error.data," ");
+   error.opts = 0;
+   error.len = 0;
    int wc = send_dgram(clisock, &client, clen, error);
    if (wc == FALSE) {
       fprintf(stderr, "Error: sendto() error.\n");
@@ -88,12 +129,14 @@ void send_error(int seq, int clisock, const struct sockaddr_in client, int clen)
    }
 }
 
-void send_ack(int seq, int clisock, const struct sockaddr_in client, int clen) {
+void send_ack(int seq, unsigned int conn, int clisock, const struct sockaddr_in client, int clen) {
    // send ack.
    mftp_packet ack;
+   ack.conn = conn;
    ack.seq = seq;
    ack.flag = ACK;
-   sprintf(ack.data," ");
+   ack.opts = 0;
+   ack.len = 0;
    int wc = send_dgram(clisock, &client, clen, ack);
    if (wc == FALSE) {
       fprintf(stderr, "Error: ack sendto() error %d.\n", wc);
@@ -102,19 +145,905 @@ void send_ack(int seq, int clisock, const struct sockaddr_in client, int clen) {
    }
 }
 
+void send_done(int seq, unsigned int conn, int clisock, const struct sockaddr_in client, int clen) {
+   // send done.
+   mftp_packet done;
+   done.conn = conn;
+   done.seq = seq;
+   done.flag = DONE;
+   done.opts = 0;
+   done.len = 0;
+   int wc = send_dgram(clisock, &client, clen, done);
+   if (wc == FALSE) {
+      fprintf(stderr, "Error: done sendto() error %d.\n", wc);
+   } else {
+      DEBUGF("Write Success (done).\n");
+   }
+}
+
 // returns 1 if success 0 if fail.
 int send_dgram(int socket, const struct sockaddr_in *cli, int dlen, const mftp_packet data) {
-    unsigned char buffer[2048], *ptr;
-    bzero(buffer, sizeof(buffer));
-    ptr = serialize_packet(data, buffer);
-    int x = sendto(socket, buffer, (ptr - buffer), 0, (sockaddr*)cli, dlen);
-    if (x != ptr - buffer) {
+    return send_frame(socket, cli, dlen, data.flag, data.opts, data.conn, data.seq, data.data, data.len);
+}
+
+// returns 1 if success 0 if fail.
+int send_frame(int socket, const struct sockaddr_in *cli, int dlen, unsigned int flag,
+               unsigned char opts, unsigned int conn, unsigned int seq, const char *data, int len) {
+    unsigned char header[MFTP_HDRLEN];
+    if (len > MFTP_MAXDATA) len = MFTP_MAXDATA;
+    // control frames carry no timestamp.
+    serialize_header(header, flag, opts & ~OPT_TS, conn, seq, 0, len);
+
+    // header and payload go to the kernel as is, no staging buffer.
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = MFTP_HDRLEN;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = len;
+    struct msghdr msg;
+    bzero(&msg, sizeof(msg));
+    msg.msg_name = (void *)cli;
+    msg.msg_namelen = dlen;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len > 0 ? 2 : 1;
+
+    int x = sendmsg(socket, &msg, 0);
+    if (x != MFTP_HDRLEN + len) {
         fprintf(stderr, "%s", strerror(errno));
     }
-    return x == (ptr - buffer);
+    return x == MFTP_HDRLEN + len;
+}
+
+int parse_view(unsigned char buffer[], int len, mftp_view *view) {
+    view->version = 0;
+    view->flag = 0;
+    view->opts = 0;
+    view->conn = 0;
+    view->seq = 0;
+    view->len = 0;
+    view->ts = 0;
+    view->data = (const char *)buffer + MFTP_HDRLEN;
+    if (len < MFTP_HDRLEN || buffer[0] != MFTP_VERSION) {
+        return FALSE;
+    }
+    unsigned short plen = 0;
+    unsigned char *p = deserialize_short(deserialize_int(deserialize_int(buffer + 4, &view->conn),
+                                                         &view->seq), &plen);
+    if (buffer[2] & OPT_TS) {
+        // the timestamp sits between the header and the payload.
+        if (len < MFTP_HDRLEN + MFTP_TSLEN) {
+            return FALSE;
+        }
+        deserialize_int(p, &view->ts);
+        view->data += MFTP_TSLEN;
+        len -= MFTP_TSLEN;
+    }
+    if (plen > MFTP_MAXDATA || plen > len - MFTP_HDRLEN) {
+        return FALSE;
+    }
+    view->version = buffer[0];
+    view->flag = buffer[1];
+    view->opts = buffer[2];
+    view->len = plen;
+    return TRUE;
+}
+
+void batch_init(rudp_batch *b, int sock) {
+    bzero(b, sizeof(*b));
+    b->sock = sock;
+    for (int i = 0; i < BATCH_SIZE; ++i) {
+        b->riov[i].iov_base = b->rbuf[i];
+        b->riov[i].iov_len = BATCH_BUFLEN;
+        b->rmsg[i].msg_hdr.msg_iov = &b->riov[i];
+        b->rmsg[i].msg_hdr.msg_iovlen = 1;
+        b->smsg[i].msg_hdr.msg_name = &b->sto[i];
+    }
+    for (int i = 0; i < BATCH_FRAMES; ++i) {
+        b->siov[2*i].iov_base = b->hdr[i];
+        b->siov[2*i].iov_len = MFTP_HDRLEN;
+        b->rfd[i] = -1;
+    }
+    for (int i = 0; i < BATCH_FILES; ++i) {
+        b->files[i] = -1;
+    }
+}
+
+int batch_enable_gso(rudp_batch *b) {
+    // probe only, the segment size is set per message with a cmsg.
+    int size = 0;
+    if (setsockopt(b->sock, IPPROTO_UDP, UDP_SEGMENT, &size, sizeof(size)) < 0) {
+        DEBUGF("UDP_SEGMENT not supported: %s.\n", strerror(errno));
+        return FALSE;
+    }
+    b->gso = TRUE;
+    return TRUE;
+}
+
+int batch_enable_gro(rudp_batch *b) {
+    int on = 1;
+    if (setsockopt(b->sock, IPPROTO_UDP, UDP_GRO, &on, sizeof(on)) < 0) {
+        DEBUGF("UDP_GRO not supported: %s.\n", strerror(errno));
+        return FALSE;
+    }
+    b->grobuf = malloc(GRO_SLOTS * GRO_BUFLEN);
+    if (b->grobuf == NULL) {
+        on = 0;
+        setsockopt(b->sock, IPPROTO_UDP, UDP_GRO, &on, sizeof(on));
+        return FALSE;
+    }
+    for (int i = 0; i < GRO_SLOTS; ++i) {
+        b->riov[i].iov_base = b->grobuf + i * GRO_BUFLEN;
+        b->riov[i].iov_len = GRO_BUFLEN;
+    }
+    b->gro = TRUE;
+    return TRUE;
+}
+
+int batch_enable_uring(rudp_batch *b) {
+    uring *r = malloc(sizeof(uring));
+    if (r == NULL) {
+        return FALSE;
+    }
+    if (!uring_init(r, 256)) {
+        DEBUGF("io_uring not available: %s.\n", strerror(errno));
+        free(r);
+        return FALSE;
+    }
+    // the socket is fixed file 0, served files get the other slots.
+    b->files[0] = b->sock;
+    struct iovec payload;
+    payload.iov_base = b->sbuf;
+    payload.iov_len = sizeof(b->sbuf);
+    if (!uring_register_files(r, b->files, BATCH_FILES) ||
+        !uring_register_buffers(r, &payload, 1)) {
+        DEBUGF("io_uring registration failed: %s.\n", strerror(errno));
+        uring_destroy(r);
+        free(r);
+        b->files[0] = -1;
+        return FALSE;
+    }
+    b->ring = r;
+    int slots = b->gro ? GRO_SLOTS : BATCH_SIZE;
+    for (int i = 0; i < slots; ++i) {
+        if (!batch_post_recv(b, i)) {
+            batch_destroy(b);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static int batch_post_recv(rudp_batch *b, int i) {
+    struct io_uring_sqe *sqe = uring_get_sqe(b->ring);
+    if (sqe == NULL) {
+        return FALSE;
+    }
+    b->rmsg[i].msg_hdr.msg_name = &b->rfrom[i];
+    b->rmsg[i].msg_hdr.msg_namelen = sizeof(b->rfrom[i]);
+    b->rmsg[i].msg_hdr.msg_control = b->gro ? b->rctl[i] : NULL;
+    b->rmsg[i].msg_hdr.msg_controllen = b->gro ? sizeof(b->rctl[i]) : 0;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = 0;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (unsigned long)&b->rmsg[i].msg_hdr;
+    sqe->len = 1;
+    sqe->user_data = RING_TAG(RING_RECV, i);
+    return TRUE;
+}
+
+static void batch_reap(rudp_batch *b) {
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(b->ring)) != NULL) {
+        unsigned long long kind = cqe->user_data >> 32;
+        int i = (int)(cqe->user_data & 0xffffffffULL);
+        int res = cqe->res;
+        uring_cqe_seen(b->ring);
+        switch (kind) {
+          case RING_RECV:
+              if (res >= 0) {
+                  b->rmsg[i].msg_len = res;
+                  b->rready[b->nready++] = i;
+              } else {
+                  // an icmp error or similar, keep the buffer receiving.
+                  DEBUGF("ring recvmsg failed: %s.\n", strerror(-res));
+                  b->ring_failed++;
+                  batch_post_recv(b, i);
+              }
+              break;
+          case RING_READ:
+              b->inflight--;
+              if (res < 0) {
+                  DEBUGF("ring read failed: %s.\n", strerror(-res));
+                  b->ring_failed++;
+              } else {
+                  b->ring_reads++;
+              }
+              break;
+          case RING_SEND:
+              b->inflight--;
+              if (res < 0) {
+                  // a failed read cancels the send linked behind it.
+                  DEBUGF("ring sendmsg failed: %s.\n", strerror(-res));
+                  b->ring_failed++;
+              }
+              break;
+          case RING_WATCH:
+              b->watched = TRUE;
+              break;
+          default:
+              break;
+        }
+    }
+}
+
+static void batch_settle(rudp_batch *b) {
+    while (b->inflight > 0) {
+        if (uring_submit(b->ring, 1, -1) < 0) {
+            fprintf(stderr, "Error: io_uring_enter() failed: %s.\n", strerror(errno));
+            b->inflight = 0;
+            break;
+        }
+        batch_reap(b);
+    }
 }
 
-mftp_packet parse_dgram(unsigned char buffer[]) {
-    mftp_packet p = deserialize_packet(buffer);
-    return p;
+int batch_wait(rudp_batch *b, long long timeout_usec) {
+    if (b->ring == NULL) {
+        struct pollfd pfd;
+        pfd.fd = b->sock;
+        pfd.events = POLLIN;
+        int ms = timeout_usec < 0 ? -1 : (int)((timeout_usec + 999) / 1000);
+        int n = poll(&pfd, 1, ms);
+        if (n < 0) {
+            return errno == EINTR ? 0 : -1;
+        }
+        return n > 0;
+    }
+    // submit everything queued and sleep in the same system call.
+    batch_reap(b);
+    unsigned wait_nr = (b->nready > 0 || b->watched) ? 0 : 1;
+    if (uring_submit(b->ring, wait_nr, timeout_usec) < 0) {
+        return -1;
+    }
+    batch_reap(b);
+    return b->nready > 0;
+}
+
+int batch_watch(rudp_batch *b, int fd) {
+    if (b->ring == NULL) {
+        return FALSE;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(b->ring);
+    if (sqe == NULL) {
+        return FALSE;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = RING_TAG(RING_WATCH, 0);
+    return TRUE;
+}
+
+int batch_add_file(rudp_batch *b, int fd) {
+    if (b->ring == NULL) {
+        return -1;
+    }
+    for (int slot = 1; slot < BATCH_FILES; ++slot) {
+        if (b->files[slot] == -1) {
+            if (!uring_update_file(b->ring, slot, fd)) {
+                return -1;
+            }
+            b->files[slot] = fd;
+            return slot;
+        }
+    }
+    return -1;
+}
+
+void batch_drain(rudp_batch *b) {
+    if (b->queued > 0) {
+        batch_flush(b);
+    }
+    if (b->ring != NULL) {
+        batch_settle(b);
+    }
+}
+
+void batch_remove_file(rudp_batch *b, int slot) {
+    if (b->ring == NULL || slot <= 0 || slot >= BATCH_FILES) {
+        return;
+    }
+    // reads still queued on the slot must go out before it is emptied.
+    batch_drain(b);
+    uring_update_file(b->ring, slot, -1);
+    b->files[slot] = -1;
+}
+
+void batch_destroy(rudp_batch *b) {
+    if (b->ring != NULL) {
+        batch_settle(b);
+        uring_destroy(b->ring);
+        free(b->ring);
+        b->ring = NULL;
+    }
+    free(b->grobuf);
+    b->grobuf = NULL;
+    b->gro = FALSE;
+}
+
+int batch_recv(rudp_batch *b) {
+    if (b->ring != NULL) {
+        // the views from last time are done with, receive into them again.
+        for (int k = 0; k < b->ndone; ++k) {
+            batch_post_recv(b, b->rdone[k]);
+        }
+        b->ndone = 0;
+        b->count = 0;
+        batch_reap(b);
+        if (b->nready == 0) {
+            return 0;
+        }
+        b->recv_calls++;
+        b->recv_dgrams += b->nready;
+        for (int k = 0; k < b->nready; ++k) {
+            batch_split(b, b->rready[k]);
+            b->rdone[b->ndone++] = b->rready[k];
+        }
+        b->nready = 0;
+        b->recv_frames += b->count;
+        return b->count;
+    }
+    int slots = b->gro ? GRO_SLOTS : BATCH_SIZE;
+    for (int i = 0; i < slots; ++i) {
+        b->rmsg[i].msg_hdr.msg_name = &b->rfrom[i];
+        b->rmsg[i].msg_hdr.msg_namelen = sizeof(b->rfrom[i]);
+        b->rmsg[i].msg_hdr.msg_control = b->gro ? b->rctl[i] : NULL;
+        b->rmsg[i].msg_hdr.msg_controllen = b->gro ? sizeof(b->rctl[i]) : 0;
+    }
+    b->count = 0;
+    int n = recvmmsg(b->sock, b->rmsg, slots, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    b->recv_calls++;
+    b->recv_dgrams += n;
+
+    // split coalesced datagrams back into the frames they were sent as.
+    for (int i = 0; i < n; ++i) {
+        batch_split(b, i);
+    }
+    b->recv_frames += b->count;
+    return b->count;
+}
+
+static void batch_split(rudp_batch *b, int i) {
+    unsigned char *buf = b->riov[i].iov_base;
+    int len = b->rmsg[i].msg_len;
+    int size = len;
+    struct cmsghdr *cm = NULL;
+    if (b->gro) {
+        for (cm = CMSG_FIRSTHDR(&b->rmsg[i].msg_hdr); cm != NULL;
+             cm = CMSG_NXTHDR(&b->rmsg[i].msg_hdr, cm)) {
+            if (cm->cmsg_level == IPPROTO_UDP && cm->cmsg_type == UDP_GRO) {
+                memcpy(&size, CMSG_DATA(cm), sizeof(size));
+            }
+        }
+    }
+    if (size <= 0) size = len;
+    for (int off = 0; off < len && b->count < BATCH_SEGS; off += size) {
+        b->seg[b->count] = buf + off;
+        b->seglen[b->count] = len - off < size ? len - off : size;
+        b->segmsg[b->count] = i;
+        b->count++;
+    }
+}
+
+int batch_view(rudp_batch *b, int i, mftp_view *view, struct sockaddr_in *from) {
+    *from = b->rfrom[b->segmsg[i]];
+    if (!parse_view(b->seg[i], b->seglen[i], view)) {
+        return FALSE;
+    }
+    // terminate text payloads, unless another frame follows in the buffer.
+    int last = i + 1 == b->count || b->segmsg[i + 1] != b->segmsg[i];
+    int room = b->gro ? GRO_BUFLEN : BATCH_BUFLEN;
+    unsigned char *end = (unsigned char *)view->data + view->len;
+    if (last && end < (unsigned char *)b->riov[b->segmsg[i]].iov_base + room) {
+        *end = '\0';
+    }
+    return TRUE;
+}
+
+char *batch_buffer(rudp_batch *b) {
+    // flush while the next frame could still need a message of its own,
+    // or batch_queue would flush after this slot was lent out and a later
+    // frame would be handed the same slot.
+    if (b->queued == BATCH_FRAMES || b->msgs == BATCH_SIZE) {
+        batch_flush(b);
+    }
+    if (b->ring != NULL && b->queued == 0) {
+        batch_settle(b);
+    }
+    return b->sbuf[b->queued];
+}
+
+void batch_queue(rudp_batch *b, const struct sockaddr_in *to, int tolen, unsigned int flag,
+                 unsigned char opts, unsigned int conn, unsigned int seq, unsigned int ts,
+                 const char *data, int len) {
+    if (len > MFTP_MAXDATA) len = MFTP_MAXDATA;
+    int hdrlen = (opts & OPT_TS) ? MFTP_HDRLEN + MFTP_TSLEN : MFTP_HDRLEN;
+    int size = hdrlen + len;
+
+    // a frame can ride on the last train if every frame so far is full
+    // size, it is no bigger than them, and it goes to the same place.
+    int m = b->msgs - 1;
+    int join = b->gso && m >= 0 && b->msgsegs[m] < GSO_SEGS
+            && (b->msgsegs[m] + 1) * b->msgsize[m] <= GSO_BYTES
+            && b->msglast[m] == b->msgsize[m] && size <= b->msgsize[m]
+            && b->sto[m].sin_port == to->sin_port
+            && b->sto[m].sin_addr.s_addr == to->sin_addr.s_addr;
+    if (b->queued == BATCH_FRAMES || (!join && b->msgs == BATCH_SIZE)) {
+        batch_flush(b);
+        m = -1;
+        join = FALSE;
+    }
+    if (b->ring != NULL && b->queued == 0) {
+        batch_settle(b);
+    }
+
+    int i = b->queued++;
+    b->rfd[i] = -1;
+    serialize_header(b->hdr[i], flag, opts, conn, seq, ts, len);
+    b->siov[2*i].iov_len = hdrlen;
+    b->siov[2*i + 1].iov_base = (void *)data;
+    b->siov[2*i + 1].iov_len = len;
+    if (join) {
+        b->smsg[m].msg_hdr.msg_iovlen += 2;
+        b->msgsegs[m]++;
+        b->msglast[m] = size;
+    } else {
+        m = b->msgs++;
+        b->sto[m] = *to;
+        b->smsg[m].msg_hdr.msg_namelen = tolen;
+        b->smsg[m].msg_hdr.msg_iov = &b->siov[2*i];
+        b->smsg[m].msg_hdr.msg_iovlen = 2;
+        b->msgsegs[m] = 1;
+        b->msgsize[m] = size;
+        b->msglast[m] = size;
+    }
+}
+
+void batch_queue_read(rudp_batch *b, const struct sockaddr_in *to, int tolen, unsigned int flag,
+                      unsigned char opts, unsigned int conn, unsigned int seq, unsigned int ts,
+                      int fd, int slot, long long offset, int len) {
+    if (len > MFTP_MAXDATA) len = MFTP_MAXDATA;
+    if (len < 0) len = 0;
+    char *data = batch_buffer(b);
+    if (b->ring == NULL) {
+        int numbytes = 0;
+        while (numbytes < len) {
+            int x = pread(fd, data + numbytes, len - numbytes, offset + numbytes);
+            if (x <= 0) {
+                fprintf(stderr, "Warning: pread() of segment %u stopped at %d bytes.\n", seq, numbytes);
+                break;
+            }
+            numbytes += x;
+        }
+        batch_queue(b, to, tolen, flag, opts, conn, seq, ts, data, numbytes);
+        return;
+    }
+    int i = b->queued;
+    batch_queue(b, to, tolen, flag, opts, conn, seq, ts, data, len);
+    if (len > 0) {
+        b->rfd[i] = slot >= 0 ? slot : fd;
+        b->rfixed[i] = slot >= 0;
+        b->roff[i] = offset;
+    }
+}
+
+void batch_queue_sack(rudp_batch *b, const struct sockaddr_in *to, int tolen, unsigned int conn,
+                      const recv_window *w, unsigned char opts, unsigned int ts) {
+    unsigned char *map = (unsigned char *)batch_buffer(b);
+    int len = 0;
+    bzero(map, SACK_BYTES);
+    for (unsigned int i = 0; i + 1 < MAX_WINDOW; ++i) {
+        if (w->have[(w->base + 1 + i) % MAX_WINDOW]) {
+            map[i / 8] |= (unsigned char)(1 << (i % 8));
+            len = i / 8 + 1;
+        }
+    }
+    batch_queue(b, to, tolen, ACK, opts | OPT_SACK, conn, w->base, ts, (char *)map, len);
+}
+
+// queues each message of the batch on the ring, behind the reads that
+// fill in its payloads.
+static int batch_flush_ring(rudp_batch *b) {
+    int status = TRUE;
+    for (int m = 0; m < b->msgs; ++m) {
+        struct msghdr *msg = &b->smsg[m].msg_hdr;
+        int first = (int)(msg->msg_iov - b->siov) / 2;
+        for (int k = first; k < first + b->msgsegs[m]; ++k) {
+            if (b->rfd[k] < 0) continue;
+            struct io_uring_sqe *sqe = uring_get_sqe(b->ring);
+            if (sqe == NULL) {
+                status = FALSE;
+                break;
+            }
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->fd = b->rfd[k];
+            sqe->flags = IOSQE_IO_LINK | (b->rfixed[k] ? IOSQE_FIXED_FILE : 0);
+            sqe->addr = (unsigned long)b->sbuf[k];
+            sqe->len = b->siov[2*k + 1].iov_len;
+            sqe->off = b->roff[k];
+            sqe->buf_index = 0;
+            sqe->user_data = RING_TAG(RING_READ, k);
+            b->inflight++;
+        }
+        struct io_uring_sqe *sqe = uring_get_sqe(b->ring);
+        if (sqe == NULL) {
+            status = FALSE;
+            break;
+        }
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = 0;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->addr = (unsigned long)msg;
+        sqe->len = 1;
+        sqe->user_data = RING_TAG(RING_SEND, m);
+        b->inflight++;
+        b->send_dgrams++;
+        b->send_frames += b->msgsegs[m];
+    }
+    if (!status) {
+        fprintf(stderr, "Error: io_uring submission queue full.\n");
+        b->ring_failed++;
+    }
+    b->queued = 0;
+    b->msgs = 0;
+    return status;
+}
+
+// sends each frame of a train as its own datagram.
+static int send_train_unsegmented(rudp_batch *b, int m) {
+    struct msghdr msg = b->smsg[m].msg_hdr;
+    msg.msg_control = NULL;
+    msg.msg_controllen = 0;
+    msg.msg_iovlen = 2;
+    for (int k = 0; k < b->msgsegs[m]; ++k) {
+        if (sendmsg(b->sock, &msg, 0) < 0) {
+            return FALSE;
+        }
+        msg.msg_iov += 2;
+    }
+    b->send_calls += b->msgsegs[m];
+    b->send_dgrams += b->msgsegs[m];
+    b->send_frames += b->msgsegs[m];
+    return TRUE;
+}
+
+int batch_flush(rudp_batch *b) {
+    for (int m = 0; m < b->msgs; ++m) {
+        struct msghdr *msg = &b->smsg[m].msg_hdr;
+        msg->msg_control = NULL;
+        msg->msg_controllen = 0;
+        if (b->msgsegs[m] > 1) {
+            // tell the kernel where to cut the train into datagrams.
+            msg->msg_control = b->sctl[m];
+            msg->msg_controllen = sizeof(b->sctl[m]);
+            struct cmsghdr *cm = CMSG_FIRSTHDR(msg);
+            cm->cmsg_level = IPPROTO_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(unsigned short));
+            unsigned short size = b->msgsize[m];
+            memcpy(CMSG_DATA(cm), &size, sizeof(size));
+        }
+    }
+    if (b->ring != NULL) {
+        return b->msgs > 0 ? batch_flush_ring(b) : TRUE;
+    }
+
+    int sent = 0;
+    int status = TRUE;
+    while (sent < b->msgs) {
+        int n = sendmmsg(b->sock, b->smsg + sent, b->msgs - sent, 0);
+        if (n <= 0) {
+            if (b->msgsegs[sent] > 1 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+                // the route cannot segment, send this train the slow way.
+                DEBUGF("UDP_SEGMENT send failed (%s), turning GSO off.\n", strerror(errno));
+                b->gso = FALSE;
+                if (send_train_unsegmented(b, sent)) {
+                    sent++;
+                    continue;
+                }
+            }
+            if (b->msgsegs[sent] > 1 && errno == EMSGSIZE) {
+                // the train is too big for one datagram, split it up
+                // and keep GSO for the trains that fit.
+                DEBUGF("UDP_SEGMENT train of %d frames too long, splitting it.\n", b->msgsegs[sent]);
+                if (send_train_unsegmented(b, sent)) {
+                    sent++;
+                    continue;
+                }
+            }
+            fprintf(stderr, "Error: sendmmsg() error: %s.\n", strerror(errno));
+            status = FALSE;
+            break;
+        }
+        b->send_calls++;
+        for (int m = sent; m < sent + n; ++m) {
+            b->send_dgrams++;
+            b->send_frames += b->msgsegs[m];
+        }
+        sent += n;
+    }
+    b->queued = 0;
+    b->msgs = 0;
+    return status;
+}
+
+void print_batch_stats(const rudp_batch *b, const char *who) {
+    if (b->ring != NULL) {
+        printf("%s: io_uring %lu enters %lu sqes, received %lu datagrams %lu frames, "
+               "sent %lu messages %lu frames, %lu file reads, %lu failed%s\n", who,
+               b->ring->enter_calls, b->ring->sqes_submitted, b->recv_dgrams, b->recv_frames,
+               b->send_dgrams, b->send_frames, b->ring_reads, b->ring_failed,
+               b->gso ? " gso" : "");
+        return;
+    }
+    printf("%s: recvmmsg %lu calls %lu datagrams %lu frames (%.1f frames per call), "
+           "sendmmsg %lu calls %lu messages %lu frames (%.1f frames per call)%s%s\n", who,
+           b->recv_calls, b->recv_dgrams, b->recv_frames,
+           b->recv_calls ? (double)b->recv_frames / b->recv_calls : 0.0,
+           b->send_calls, b->send_dgrams, b->send_frames,
+           b->send_calls ? (double)b->send_frames / b->send_calls : 0.0,
+           b->gso ? " gso" : "", b->gro ? " gro" : "");
+}
+
+long long current_time_usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+unsigned int new_conn_id(void) {
+    unsigned int id = 0;
+    while (id == 0) {
+        if (getrandom(&id, sizeof(id), 0) != sizeof(id)) {
+            // no entropy source, time and address are unique enough here.
+            id = (unsigned int)current_time_usec() ^ (unsigned int)(unsigned long)&id;
+        }
+    }
+    return id;
+}
+
+void send_window_init(send_window *w, unsigned int size, unsigned int total) {
+    bzero(w, sizeof(*w));
+    w->size = (size == 0 || size > MAX_WINDOW) ? MAX_WINDOW : size;
+    w->total = total;
+}
+
+int send_window_open(const send_window *w) {
+    return w->next < w->total && w->next < w->base + w->size;
+}
+
+void send_window_sent(send_window *w, unsigned int seq, long long now) {
+    if (seq == w->next) {
+        w->acked[seq % MAX_WINDOW] = FALSE;
+        w->next++;
+    }
+    w->sent[seq % MAX_WINDOW] = now;
+    w->order[seq % MAX_WINDOW] = ++w->sends;
+    w->later[seq % MAX_WINDOW] = 0;
+}
+
+int send_window_ack(send_window *w, unsigned int seq) {
+    if (seq < w->base || seq >= w->next || !send_window_mark(w, seq)) {
+        return FALSE;
+    }
+    // slide past everything acknowledged at the front of the window.
+    while (w->base < w->next && w->acked[w->base % MAX_WINDOW]) {
+        w->base++;
+    }
+    return TRUE;
+}
+
+static int send_window_mark(send_window *w, unsigned int seq) {
+    if (w->acked[seq % MAX_WINDOW]) {
+        return FALSE;
+    }
+    w->acked[seq % MAX_WINDOW] = TRUE;
+    if (seq + 1 > w->highest) {
+        w->highest = seq + 1;
+    }
+    // only the DUP_THRESH latest sends matter to the tally, a segment
+    // sent before all of them has been passed enough already.
+    unsigned int order = w->order[seq % MAX_WINDOW];
+    for (int k = 0; k < DUP_THRESH; ++k) {
+        if (order > w->newest[k]) {
+            unsigned int t = w->newest[k];
+            w->newest[k] = order;
+            order = t;
+        }
+    }
+    return TRUE;
+}
+
+int send_window_sack(send_window *w, unsigned int cum, const char *map, int len) {
+    int acked = 0;
+    if (len > SACK_BYTES) len = SACK_BYTES;
+    unsigned int end = cum + 1 + len * 8;
+    if (end > w->next) end = w->next;
+    // one walk over the window: everything below cum arrived, the
+    // bitmap says which segments past it did.
+    for (unsigned int seq = w->base; seq < end; ++seq) {
+        if (seq >= cum) {
+            unsigned int i = seq - cum - 1;
+            if (seq == cum || !(map[i / 8] & (1 << (i % 8)))) continue;
+        }
+        acked += send_window_mark(w, seq);
+    }
+    while (w->base < w->next && w->acked[w->base % MAX_WINDOW]) {
+        w->base++;
+    }
+    return acked;
+}
+
+int send_window_tally(send_window *w, unsigned int *lost) {
+    int n = 0;
+    // segments above the highest ack were sent after everything acked.
+    for (unsigned int seq = w->base; seq < w->highest && seq < w->next; ++seq) {
+        unsigned int slot = seq % MAX_WINDOW;
+        if (w->acked[slot]) continue;
+        int passed = 0;
+        while (passed < DUP_THRESH && w->newest[passed] > w->order[slot]) {
+            passed++;
+        }
+        int later = w->later[slot] + passed;
+        w->later[slot] = later > 255 ? 255 : later;
+        if (later >= DUP_THRESH) {
+            lost[n++] = seq;
+        }
+    }
+    w->highest = 0;
+    bzero(w->newest, sizeof(w->newest));
+    return n;
+}
+
+int send_window_expired(const send_window *w, unsigned int seq, long long now, long long rto) {
+    if (seq < w->base || seq >= w->next || w->acked[seq % MAX_WINDOW]) {
+        return FALSE;
+    }
+    return now - w->sent[seq % MAX_WINDOW] >= rto;
+}
+
+long long send_window_timeout(const send_window *w, long long now, long long rto) {
+    long long wait = -1;
+    for (unsigned int seq = w->base; seq < w->next; ++seq) {
+        if (w->acked[seq % MAX_WINDOW]) continue;
+        long long left = w->sent[seq % MAX_WINDOW] + rto - now;
+        if (left < 0) left = 0;
+        if (wait == -1 || left < wait) wait = left;
+    }
+    return wait;
+}
+
+int send_window_done(const send_window *w) {
+    return w->base == w->total;
+}
+
+void rtt_init(rtt_estimator *r) {
+    bzero(r, sizeof(*r));
+    r->rto = SEGMENT_TIMEOUT;
+}
+
+void rtt_sample(rtt_estimator *r, long long rtt) {
+    if (rtt < 1) rtt = 1;
+    if (rtt > RTO_MAX) rtt = RTO_MAX;
+    if (r->samples == 0) {
+        r->srtt = rtt;
+        r->rttvar = rtt / 2;
+    } else {
+        // alpha 1/8 and beta 1/4.
+        long long err = rtt - r->srtt;
+        r->srtt += err / 8;
+        r->rttvar += ((err < 0 ? -err : err) - r->rttvar) / 4;
+    }
+    r->samples++;
+    r->rto = r->srtt + 4 * r->rttvar;
+    if (r->rto < RTO_MIN) r->rto = RTO_MIN;
+    if (r->rto > RTO_MAX) r->rto = RTO_MAX;
+}
+
+void rtt_backoff(rtt_estimator *r) {
+    r->rto *= 2;
+    if (r->rto > RTO_MAX) r->rto = RTO_MAX;
+    r->backoffs++;
+}
+
+long long rtt_from_echo(unsigned int ts, long long now) {
+    // the clocks agree, only the low bits went over the wire.
+    return (long long)(unsigned int)((unsigned int)now - ts);
+}
+
+void ack_policy_init(ack_policy *a, int every, long long delay) {
+    bzero(a, sizeof(*a));
+    a->every = every < 1 ? 1 : every;
+    a->delay = delay < 0 ? 0 : delay;
+}
+
+int ack_policy_data(ack_policy *a, long long now, int gap) {
+    if (a->pending++ == 0) {
+        a->first = now;
+    }
+    if (gap) {
+        // the sender learns of a loss, or of its repair, without delay.
+        a->urgent = TRUE;
+        return TRUE;
+    }
+    return a->pending >= a->every || now - a->first >= a->delay;
+}
+
+long long ack_policy_timeout(const ack_policy *a, long long now) {
+    if (a->pending == 0) {
+        return -1;
+    }
+    long long left = a->first + a->delay - now;
+    return left < 0 ? 0 : left;
+}
+
+void ack_policy_sent(ack_policy *a) {
+    if (a->urgent) {
+        a->immediate++;
+    }
+    a->pending = 0;
+    a->urgent = FALSE;
+    a->acks++;
+}
+
+void recv_window_init(recv_window *w) {
+    w->base = 0;
+    bzero(w->have, sizeof(w->have));
+}
+
+int recv_window_store(recv_window *w, unsigned int seq, const char *data, int len) {
+    if (seq < w->base || seq >= w->base + MAX_WINDOW || w->have[seq % MAX_WINDOW]) {
+        return FALSE;
+    }
+    if (len > SEGMENT_SIZE) len = SEGMENT_SIZE;
+    memcpy(w->data[seq % MAX_WINDOW], data, len);
+    w->len[seq % MAX_WINDOW] = len;
+    w->have[seq % MAX_WINDOW] = TRUE;
+    return TRUE;
+}
+
+int recv_window_in_order(const recv_window *w, unsigned int seq) {
+    return seq == w->base && !w->have[seq % MAX_WINDOW];
+}
+
+void recv_window_skip(recv_window *w) {
+    w->have[w->base % MAX_WINDOW] = FALSE;
+    w->base++;
+}
+
+int recv_window_mark(recv_window *w, unsigned int seq) {
+    if (seq < w->base || seq >= w->base + MAX_WINDOW || w->have[seq % MAX_WINDOW]) {
+        return FALSE;
+    }
+    w->have[seq % MAX_WINDOW] = TRUE;
+    while (w->have[w->base % MAX_WINDOW]) {
+        w->have[w->base % MAX_WINDOW] = FALSE;
+        w->base++;
+    }
+    return TRUE;
+}
+
+int recv_window_next(recv_window *w, char **data, int *len) {
+    unsigned int slot = w->base % MAX_WINDOW;
+    if (!w->have[slot]) {
+        return FALSE;
+    }
+    w->have[slot] = FALSE;
+    *data = w->data[slot];
+    *len = w->len[slot];
+    w->base++;
+    return TRUE;
 }
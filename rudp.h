@@ -5,6 +5,9 @@
 #ifndef __RUDP_H__
 #define __RUDP_H__
 
+#include <sys/socket.h>
+#include <netinet/in.h>
+
 // uncomment to turn off debugging.
 //#define NDEBUG NoDebug
 
@@ -18,17 +21,282 @@ typedef struct sockaddr_in sockaddr_in;
 #define DATA  2
 #define ACK   3
 #define ERROR 4
+#define DONE  5
+#define REQ   6
+
+/**
+ * Number of file bytes carried by one DATA packet.
+ */
+#define SEGMENT_SIZE 1023
+
+/**
+ * Default and largest number of unacknowledged DATA packets a server 
+ * connection may have in flight.
+ */
+#define DEFAULT_WINDOW 32
+#define MAX_WINDOW     256
+
+/**
+ * Default and largest size of a file the server sends whole in its reply
+ * to a REQ, without keeping a session for it.
+ */
+#define INLINE_SIZE     (4 * SEGMENT_SIZE)
+#define MAX_INLINE_SIZE (DEFAULT_WINDOW * SEGMENT_SIZE)
+
+/**
+ * Microseconds before an unacknowledged DATA packet is sent again, until
+ * the connection has measured its round trip time.
+ */
+#define SEGMENT_TIMEOUT 200000
+
+/**
+ * Bounds on the retransmission timeout worked out from the round trip
+ * time, in microseconds.
+ */
+#define RTO_MIN 10000
+#define RTO_MAX 2000000
+
+/**
+ * Acks of segments sent after an unacknowledged one that mark it lost
+ * and resend it at once, as three duplicate acks do in TCP.
+ */
+#define DUP_THRESH 3
+
+/**
+ * Wire format version. Datagrams with any other version are dropped.
+ */
+#define MFTP_VERSION 2
+
+/**
+ * Bytes in the packet header on the wire: version, flag, opts and a 
+ * reserved byte, then a 4 byte connection id, a 4 byte sequence number 
+ * and a 2 byte payload length, all in network byte order. Only len bytes
+ * of data follow.
+ */
+#define MFTP_HDRLEN  14
+
+/**
+ * Bytes of the timestamp that follows the header, before the payload,
+ * when the OPT_TS bit is set. A DATA packet carries the low 32 bits of
+ * the sender's clock in microseconds, the ACK of it echoes them back.
+ */
+#define MFTP_TSLEN   4
+
+/**
+ * Largest payload a packet can carry. data always has room for a 
+ * terminating nul after the payload.
+ */
+#define MFTP_MAXDATA 1023
+
+/**
+ * Option bits for the opts field.
+ */
+#define OPT_RESENT 0x01   // packet is a retransmission.
+#define OPT_INLINE 0x02   // the whole file follows the reply, no session is kept.
+#define OPT_TS     0x04   // a timestamp follows the header.
+#define OPT_SACK   0x08   // ack of every segment below seq, a bitmap of later ones follows.
+
+/**
+ * Bytes in the widest SACK bitmap. Bit i, counted from the low bit of
+ * the first byte, stands for segment seq + 1 + i, so the bitmap covers
+ * the rest of a receive window. Trailing zero bytes are not sent.
+ */
+#define SACK_BYTES (MAX_WINDOW / 8)
+
+/**
+ * Default data packets per ack and the longest an ack is held back, in
+ * microseconds. The delay stays under RTO_MIN so held acks never make
+ * the sender resend.
+ */
+#define ACK_EVERY 8
+#define ACK_DELAY 2000
 
 /**
  * My custom protocol packet.
  */
 typedef struct mftp_packet {
-    unsigned int seq;           // sequence number
-    char data[1024];    // packet data.
+    unsigned char version;      // wire format version.
     unsigned int flag;          // flag for type of data.
+    unsigned char opts;         // option bits.
+    unsigned int conn;          // connection id picked by the client.
+    unsigned int seq;           // sequence number
+    unsigned short len;         // bytes of data in use.
+    unsigned int ts;            // timestamp, sent only with OPT_TS.
+    char data[MFTP_MAXDATA + 1];    // packet data.
 } mftp_packet;
 typedef mftp_packet *mftp_packet_ref;
 
+/**
+ * A received packet parsed in place. Same fields as mftp_packet but data
+ * points into the receive buffer instead of being copied out of it, so 
+ * it is only valid until that buffer is reused.
+ */
+typedef struct mftp_view {
+    unsigned char version;      // wire format version.
+    unsigned int flag;          // flag for type of data.
+    unsigned char opts;         // option bits.
+    unsigned int conn;          // connection id picked by the client.
+    unsigned int seq;           // sequence number
+    unsigned short len;         // bytes of data in use.
+    unsigned int ts;            // timestamp, 0 without OPT_TS.
+    const char *data;           // payload inside the receive buffer.
+} mftp_view;
+
+/**
+ * Most datagrams moved by one recvmmsg(2) or sendmmsg(2) call, the most
+ * frames that can be queued before a flush, and the size of each 
+ * receive buffer in a batch.
+ */
+#define BATCH_SIZE   32
+#define BATCH_FRAMES 64
+#define BATCH_BUFLEN 1100
+
+/**
+ * UDP segmentation offload limits. A GSO train is at most GSO_SEGS
+ * frames and GSO_BYTES bytes, the largest UDP payload over IPv4, so a
+ * train of stamped full frames (1041 bytes each) holds 62 of them. With
+ * GRO the kernel hands back up to GRO_SEGS frames glued into one buffer.
+ */
+#define GSO_SEGS   63
+#define GSO_BYTES  65507
+#define GRO_SLOTS  8
+#define GRO_SEGS   64
+#define GRO_BUFLEN 65536
+#define BATCH_SEGS (GRO_SLOTS * GRO_SEGS)
+
+/**
+ * Slots in the io_uring fixed file table of a batch. Slot 0 is the 
+ * batch socket, the rest hold files being served.
+ */
+#define BATCH_FILES 64
+
+struct uring;
+
+/**
+ * Batched datagram I/O on one socket. Received datagrams stay in their 
+ * receive buffers until the next batch_recv, outgoing frames are queued
+ * until batch_flush sends them all with one system call.
+ *
+ * With GSO on, consecutive frames to the same address are queued as one
+ * train: a single message whose iovecs hold every frame back to back, 
+ * which the kernel cuts into datagrams at the UDP_SEGMENT size. With GRO
+ * on, coalesced datagrams are split back into frames by batch_recv, so
+ * callers see one view per frame either way.
+ *
+ * With io_uring on, every receive buffer always has a recvmsg posted on
+ * the ring, batch_wait submits and waits in one io_uring_enter(2) and 
+ * batch_recv only collects what completed. Frames queued with 
+ * batch_queue_read have their payload read by the ring as well, linked 
+ * in front of the sendmsg that carries them, into registered buffers 
+ * from fixed files.
+ */
+typedef struct rudp_batch {
+    int sock;                                     // socket the batch reads and writes.
+    int gso;                                      // 1 if sends use UDP_SEGMENT trains.
+    int gro;                                      // 1 if receives use UDP_GRO.
+
+    int count;                                    // frames from the last batch_recv.
+    unsigned char rbuf[BATCH_SIZE][BATCH_BUFLEN]; // received datagrams.
+    unsigned char *grobuf;                        // GRO_SLOTS big buffers when gro is on.
+    struct sockaddr_in rfrom[BATCH_SIZE];         // sender of each datagram.
+    struct iovec riov[BATCH_SIZE];
+    struct mmsghdr rmsg[BATCH_SIZE];
+    char rctl[BATCH_SIZE][CMSG_SPACE(sizeof(int))];
+    unsigned char *seg[BATCH_SEGS];               // start of each received frame.
+    int seglen[BATCH_SEGS];                       // length of each received frame.
+    int segmsg[BATCH_SEGS];                       // datagram each frame came from.
+
+    int queued;                                   // frames waiting to be flushed.
+    int msgs;                                     // messages those frames make up.
+    unsigned char hdr[BATCH_FRAMES][MFTP_HDRLEN + MFTP_TSLEN]; // header of each queued frame.
+    char sbuf[BATCH_FRAMES][MFTP_MAXDATA];        // payload space lent by batch_buffer.
+    struct iovec siov[BATCH_FRAMES * 2];          // header and payload of each frame.
+    struct sockaddr_in sto[BATCH_SIZE];           // destination of each message.
+    struct mmsghdr smsg[BATCH_SIZE];
+    int msgsegs[BATCH_SIZE];                      // frames in each message.
+    int msgsize[BATCH_SIZE];                      // size of the first frame of each message.
+    int msglast[BATCH_SIZE];                      // size of the last frame of each message.
+    char sctl[BATCH_SIZE][CMSG_SPACE(sizeof(unsigned short))];
+
+    struct uring *ring;                           // io_uring engine, NULL for system calls.
+    int rready[BATCH_SIZE];                       // receive slots completed on the ring.
+    int nready;
+    int rdone[BATCH_SIZE];                        // slots handed out by the last batch_recv.
+    int ndone;
+    int rfd[BATCH_FRAMES];                        // file each payload is read from, -1 if none.
+    int rfixed[BATCH_FRAMES];                     // 1 if rfd is a fixed file slot.
+    long long roff[BATCH_FRAMES];                 // file offset of each read.
+    int inflight;                                 // ring operations not completed yet.
+    int watched;                                  // set once the batch_watch fd is readable.
+    int files[BATCH_FILES];                       // fixed file table, -1 for a free slot.
+
+    unsigned long recv_calls;                     // recvmmsg calls that returned data.
+    unsigned long recv_dgrams;                    // datagrams they returned.
+    unsigned long recv_frames;                    // frames after splitting GRO datagrams.
+    unsigned long send_calls;                     // sendmmsg calls made.
+    unsigned long send_dgrams;                    // messages they sent.
+    unsigned long send_frames;                    // frames those messages carried.
+    unsigned long ring_reads;                     // file reads done by the ring.
+    unsigned long ring_failed;                    // ring operations that failed.
+} rudp_batch;
+
+/**
+ * Sender half of the selective repeat window. Segment n of a chunk is 
+ * sent with sequence number n and tracked in slot n % MAX_WINDOW until 
+ * the client acknowledges it.
+ */
+typedef struct send_window {
+    unsigned int base;                // oldest unacknowledged segment.
+    unsigned int next;                // next segment never sent before.
+    unsigned int size;                // segments allowed in flight.
+    unsigned int total;               // segments in the whole chunk.
+    unsigned int sends;               // transmissions so far, new or resent.
+    unsigned int highest;             // one past the highest segment acked since the last tally.
+    unsigned int newest[DUP_THRESH];  // largest send orders acked since then, largest first.
+    unsigned char acked[MAX_WINDOW];  // 1 if slot has been acknowledged.
+    unsigned char later[MAX_WINDOW];  // acks of segments sent after the slot's last send.
+    unsigned int order[MAX_WINDOW];   // transmission number of the slot's last send.
+    long long sent[MAX_WINDOW];       // time in usec slot was last sent.
+} send_window;
+
+/**
+ * Smoothed round trip time of a connection and the retransmission
+ * timeout that follows from it, as in RFC 6298.
+ */
+typedef struct rtt_estimator {
+    long long srtt;                   // smoothed round trip time, 0 before a sample.
+    long long rttvar;                 // its mean deviation.
+    long long rto;                    // current timeout, doubled on each expiry.
+    unsigned long samples;            // round trips measured.
+    unsigned long backoffs;           // timeouts that doubled rto.
+} rtt_estimator;
+
+/**
+ * When a receiver acks. An ack goes back once every packets have come
+ * since the last one, once the oldest of them has waited delay, or at
+ * once when a packet shows or fills a gap.
+ */
+typedef struct ack_policy {
+    int every;                        // data packets per ack.
+    long long delay;                  // longest an ack is held, in usec.
+    int pending;                      // data packets since the last ack.
+    long long first;                  // when the oldest of them came.
+    int urgent;                       // one of them showed or filled a gap.
+    unsigned long acks;               // acks sent.
+    unsigned long immediate;          // acks sent at once for a gap.
+} ack_policy;
+
+/**
+ * Receiver half of the selective repeat window. Segments that arrive 
+ * ahead of base are held here until the gap before them is filled.
+ */
+typedef struct recv_window {
+    unsigned int base;                   // next segment to deliver in order.
+    unsigned char have[MAX_WINDOW];      // 1 if slot holds a segment.
+    int len[MAX_WINDOW];                 // payload length of each slot.
+    char data[MAX_WINDOW][SEGMENT_SIZE]; // payload of each slot.
+} recv_window;
+
 
 /**
  * Serializes an int into a unsigned char
@@ -75,41 +343,75 @@ unsigned char *deserialize_int(unsigned char *buffer, unsigned int *val);
 unsigned char *deserialize_data(unsigned char *buffer, char buf[], int len);
 
 /**
- * Serialize mftp_packet into a buffer
+ * Serializes a short into a unsigned char
  * 
- * @param packet The packet to be serialized into a buffer.
- * @param buffer The buffer to fill up/
- * @param len The length of the buffer.
+ * @param buffer The array to insert the data.
+ * @param val The value to serialize.
+ *  
+ * @return A pointer to the next free space in the buffer. 
  */
-unsigned char *serialize_packet(mftp_packet packet, unsigned char buffer[]);
+unsigned char *serialize_short(unsigned char *buffer, unsigned short val);
 
 /**
- * Deserialize buffer into mftp_packet
+ * Deserializes a short out of a unsigned char array
  * 
- * @param buffer The buffer to get data from.
- * @param len The length of the buffer.
+ * @param buffer The array to get the data out of.
+ * @param val The value to save the data.
+ *  
+ * @return A pointer to the next free space in the buffer. 
  */
-mftp_packet deserialize_packet(unsigned char buffer[]);
+unsigned char *deserialize_short(unsigned char *buffer, unsigned short *val);
+
+/**
+ * Serialize just a packet header into a buffer.
+ * 
+ * @param buffer The buffer to fill, at least MFTP_HDRLEN + MFTP_TSLEN bytes.
+ * @param flag The packet type.
+ * @param opts The option bits.
+ * @param conn The connection id.
+ * @param seq The sequence number.
+ * @param ts The timestamp, written only if opts has OPT_TS.
+ * @param len The length of the payload that will follow the header.
+ *
+ * @return A pointer to the byte after the header.
+ */
+unsigned char *serialize_header(unsigned char buffer[], unsigned int flag, unsigned char opts,
+                                unsigned int conn, unsigned int seq, unsigned int ts,
+                                unsigned short len);
 
 /**
  * Send an ack datagram to a socket.
  *
  * @param sequence_number The sequence number of the datagram
+ * @param conn The connection id.
  * @param clisock The socket to send the data to. 
  * @param client The reciever.
  * @param clen The length of the sockaddr_in struct.
  */
-void send_ack(int sequence_number, int clisock, sockaddr_in client, int clen);
+void send_ack(int sequence_number, unsigned int conn, int clisock, sockaddr_in client, int clen);
 
 /**
  * Send an error datagram to a socket.
  *
  * @param sequence_number The sequence number of the datagram
+ * @param conn The connection id.
+ * @param clisock The socket to send the data to. 
+ * @param client The reciever.
+ * @param clen The length of the sockaddr_in struct.
+ */
+void send_error(int sequence_number, unsigned int conn, int clisock, sockaddr_in client, int clen);
+
+/**
+ * Send a done datagram to a socket. Tells the client every segment of 
+ * its chunk has been acknowledged.
+ *
+ * @param sequence_number The sequence number of the datagram
+ * @param conn The connection id.
  * @param clisock The socket to send the data to. 
  * @param client The reciever.
  * @param clen The length of the sockaddr_in struct.
  */
-void send_error(int sequence_number, int clisock, sockaddr_in client, int clen);
+void send_done(int sequence_number, unsigned int conn, int clisock, sockaddr_in client, int clen);
 
 /**
  * Sends a datagram to a client.
@@ -124,12 +426,486 @@ void send_error(int sequence_number, int clisock, sockaddr_in client, int clen);
 int send_dgram(int socket, const struct sockaddr_in *cli, int dlen, const mftp_packet data);
 
 /**
- * Parses incoming datagrams. runs the deserializer.
+ * Sends a packet without copying its payload. Only the header is built, 
+ * then the header and the caller's data buffer are handed to sendmsg(2)
+ * as two iovecs.
+ *
+ * @param socket The socket to send to.
+ * @param cli the structure with the ip and port to send to. 
+ * @param dlen length of the stucture cli.
+ * @param flag The packet type.
+ * @param opts The option bits.
+ * @param conn The connection id.
+ * @param seq The sequence number.
+ * @param data The payload, may be NULL if len is 0.
+ * @param len The payload length, at most MFTP_MAXDATA.
+ *
+ * @return Returns 1 if successful and 0 if it fails. Approriate messages are printed to stderr.
+ */
+int send_frame(int socket, const struct sockaddr_in *cli, int dlen, unsigned int flag,
+               unsigned char opts, unsigned int conn, unsigned int seq, const char *data, int len);
+
+/**
+ * Parses a datagram in place without copying the payload out.
+ *
+ * @param buffer The received datagram.
+ * @param len The number of bytes received in the buffer.
+ * @param view Filled with the header, and data pointing into buffer.
+ *
+ * @return 1 if the datagram is a valid packet, 0 otherwise.
+ */
+int parse_view(unsigned char buffer[], int len, mftp_view *view);
+
+/**
+ * Sets up an empty batch for a socket.
+ *
+ * @param b The batch to initialize.
+ * @param sock The socket to read and write.
+ */
+void batch_init(rudp_batch *b, int sock);
+
+/**
+ * Turns on UDP segmentation offload for queued frames.
+ *
+ * @param b The batch.
+ *
+ * @return 1 if the socket accepts UDP_SEGMENT, 0 if the kernel lacks it.
+ */
+int batch_enable_gso(rudp_batch *b);
+
+/**
+ * Turns on UDP receive coalescing and switches the batch to 64 KB 
+ * receive buffers. Call batch_destroy to free them.
+ *
+ * @param b The batch.
+ *
+ * @return 1 if the socket accepts UDP_GRO, 0 if the kernel lacks it.
+ */
+int batch_enable_gro(rudp_batch *b);
+
+/**
+ * Moves the batch onto an io_uring: the socket and served files become
+ * fixed files, the payload buffers are registered, and a recvmsg is 
+ * posted for every receive buffer. Use batch_wait instead of polling the
+ * socket from then on.
+ *
+ * @param b The batch, before anything is queued on it.
+ *
+ * @return 1 if the ring is running, 0 if the kernel lacks io_uring. The
+ *         batch keeps using system calls in that case.
+ */
+int batch_enable_uring(rudp_batch *b);
+
+/**
+ * Submits every queued ring operation and sleeps until a datagram 
+ * arrives, the batch_watch fd becomes readable, or the timeout passes.
+ * Without a ring this is a poll(2) on the socket.
+ *
+ * @param b The batch.
+ * @param timeout_usec Longest wait in microseconds, -1 for no limit.
+ *
+ * @return 1 if datagrams are ready for batch_recv, 0 if not, -1 on error.
+ */
+int batch_wait(rudp_batch *b, long long timeout_usec);
+
+/**
+ * Has the ring watch another descriptor; b->watched is set once it is
+ * readable. Used to wake a worker that sleeps in batch_wait.
+ *
+ * @param b The batch, with a ring.
+ * @param fd The descriptor.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int batch_watch(rudp_batch *b, int fd);
+
+/**
+ * Puts a file in the ring's fixed file table.
+ *
+ * @param b The batch.
+ * @param fd The file.
+ *
+ * @return The slot, or -1 if there is no ring or the table is full.
+ */
+int batch_add_file(rudp_batch *b, int fd);
+
+/**
+ * Sends everything queued and, with a ring, waits until the kernel is
+ * done with it. Payload memory queued with batch_queue may be released
+ * after this returns.
+ *
+ * @param b The batch.
+ */
+void batch_drain(rudp_batch *b);
+
+/**
+ * Empties a slot returned by batch_add_file. Does nothing for -1.
+ *
+ * @param b The batch.
+ * @param slot The slot.
+ */
+void batch_remove_file(rudp_batch *b, int slot);
+
+/**
+ * Frees buffers allocated by batch_enable_gro and tears down the ring 
+ * after waiting for its operations. The batch itself is owned by the 
+ * caller.
+ *
+ * @param b The batch.
+ */
+void batch_destroy(rudp_batch *b);
+
+/**
+ * Reads every datagram waiting on the socket, up to BATCH_SIZE, with a 
+ * single non blocking recvmmsg(2). With a ring, collects the receives
+ * that completed instead and reposts the buffers of the last call. 
+ * Invalidates views from the last call.
+ *
+ * @param b The batch.
+ *
+ * @return The number of frames received, 0 if none were waiting, or -1 on error.
+ */
+int batch_recv(rudp_batch *b);
+
+/**
+ * Parses frame i of the last batch_recv in place.
+ *
+ * @param b The batch.
+ * @param i The frame index, less than b->count.
+ * @param view Filled with the packet, data points into the batch.
+ * @param from Set to the sender address.
+ *
+ * @return 1 if the datagram is a valid packet, 0 otherwise.
+ */
+int batch_view(rudp_batch *b, int i, mftp_view *view, struct sockaddr_in *from);
+
+/**
+ * Lends out payload space for the next queued frame, so data can be 
+ * read straight into it. Flushes first if the queue is full.
+ *
+ * @param b The batch.
+ *
+ * @return A buffer of MFTP_MAXDATA bytes, valid until the next flush.
+ */
+char *batch_buffer(rudp_batch *b);
+
+/**
+ * Queues a frame for the next flush. The payload is not copied, so it 
+ * must stay valid until the flush. Flushes first if the queue is full.
+ *
+ * @param b The batch.
+ * @param to The destination.
+ * @param tolen The length of to.
+ * @param flag The packet type.
+ * @param opts The option bits.
+ * @param conn The connection id.
+ * @param seq The sequence number.
+ * @param ts The timestamp, sent only if opts has OPT_TS.
+ * @param data The payload, may be NULL if len is 0.
+ * @param len The payload length.
+ */
+void batch_queue(rudp_batch *b, const struct sockaddr_in *to, int tolen, unsigned int flag,
+                 unsigned char opts, unsigned int conn, unsigned int seq, unsigned int ts,
+                 const char *data, int len);
+
+/**
+ * Queues a frame whose payload is len bytes of a file at offset. With a
+ * ring the read is linked in front of the send and done by the kernel at
+ * the next submit; without one it is a pread(2) right away.
+ *
+ * @param b The batch.
+ * @param to The destination.
+ * @param tolen The length of to.
+ * @param flag The packet type.
+ * @param opts The option bits.
+ * @param conn The connection id.
+ * @param seq The sequence number.
+ * @param ts The timestamp, sent only if opts has OPT_TS.
+ * @param fd The file.
+ * @param slot The file's fixed file slot, or -1.
+ * @param offset Where the payload starts in the file.
+ * @param len The payload length.
+ */
+void batch_queue_read(rudp_batch *b, const struct sockaddr_in *to, int tolen, unsigned int flag,
+                      unsigned char opts, unsigned int conn, unsigned int seq, unsigned int ts,
+                      int fd, int slot, long long offset, int len);
+
+/**
+ * Queues one OPT_SACK ack that describes a whole receive window: its
+ * base as the cumulative ack and a bitmap of the segments held past it.
+ *
+ * @param b The batch.
+ * @param to The destination.
+ * @param tolen The length of to.
+ * @param conn The connection id.
+ * @param w The receive window.
+ * @param opts Extra option bits, OPT_TS to echo ts.
+ * @param ts The timestamp to echo.
+ */
+void batch_queue_sack(rudp_batch *b, const struct sockaddr_in *to, int tolen, unsigned int conn,
+                      const recv_window *w, unsigned char opts, unsigned int ts);
+
+/**
+ * Sends every queued frame with sendmmsg(2). With a ring the sends are
+ * queued on it instead and go out with the next batch_wait, or as soon
+ * as the payload buffers are needed again.
+ *
+ * @param b The batch.
+ *
+ * @return 1 if all frames were sent, 0 if any failed.
+ */
+int batch_flush(rudp_batch *b);
+
+/**
+ * Prints the batch counters and the average datagrams per call.
+ *
+ * @param b The batch.
+ * @param who Label for the line, such as the connection number.
+ */
+void print_batch_stats(const rudp_batch *b, const char *who);
+
+/**
+ * Gets the current time of day in microseconds.
+ *
+ * @return The time in microseconds.
+ */
+long long current_time_usec(void);
+
+/**
+ * Picks a random connection id for a new connection. Never returns 0.
+ *
+ * @return The connection id.
+ */
+unsigned int new_conn_id(void);
+
+/**
+ * Sets up an empty send window.
+ *
+ * @param w The window to initialize.
+ * @param size The number of segments allowed in flight, capped at MAX_WINDOW.
+ * @param total The number of segments in the chunk.
+ */
+void send_window_init(send_window *w, unsigned int size, unsigned int total);
+
+/**
+ * Checks if the next new segment fits in the window.
+ *
+ * @param w The send window.
+ *
+ * @return 1 if w->next may be sent now, 0 otherwise.
+ */
+int send_window_open(const send_window *w);
+
+/**
+ * Records that a segment was just sent or resent.
+ *
+ * @param w The send window.
+ * @param seq The segment that was sent.
+ * @param now The current time in microseconds.
+ */
+void send_window_sent(send_window *w, unsigned int seq, long long now);
+
+/**
+ * Marks a segment acknowledged and slides the window past every 
+ * acknowledged segment at its base. Outstanding segments sent before 
+ * it count the ack against them at the next send_window_tally.
+ *
+ * @param w The send window.
+ * @param seq The acknowledged segment.
+ *
+ * @return 1 if the ack was for an outstanding segment, 0 if it was a duplicate or out of range.
+ */
+int send_window_ack(send_window *w, unsigned int seq);
+
+/**
+ * Applies an OPT_SACK ack: every segment below cum and every segment
+ * whose bit is set, as if each had been acked with send_window_ack.
+ *
+ * @param w The send window.
+ * @param cum The cumulative ack, the first segment not received.
+ * @param map The bitmap, bit i for segment cum + 1 + i.
+ * @param len Bytes in map.
+ *
+ * @return The number of segments newly acknowledged.
+ */
+int send_window_sack(send_window *w, unsigned int cum, const char *map, int len);
+
+/**
+ * Counts the acks since the last tally against the outstanding segments
+ * sent before them, in one pass over the segments below the highest one
+ * acked. A segment passed by DUP_THRESH acks of segments sent after it
+ * is lost and can be resent without waiting for its timeout; resending
+ * it starts the count again. Call once per ack packet.
+ *
+ * @param w The send window.
+ * @param lost Filled with the lost segments, room for MAX_WINDOW.
+ *
+ * @return The number of lost segments.
+ */
+int send_window_tally(send_window *w, unsigned int *lost);
+
+/**
+ * Checks if an outstanding segment has waited longer than the timeout.
+ *
+ * @param w The send window.
+ * @param seq The segment to check.
+ * @param now The current time in microseconds.
+ * @param rto The retransmission timeout in microseconds.
+ *
+ * @return 1 if the segment should be resent, 0 otherwise.
+ */
+int send_window_expired(const send_window *w, unsigned int seq, long long now, long long rto);
+
+/**
+ * Gets the time until the earliest outstanding segment expires.
+ *
+ * @param w The send window.
+ * @param now The current time in microseconds.
+ * @param rto The retransmission timeout in microseconds.
+ *
+ * @return Microseconds until the next resend is due, 0 if one is overdue, or -1 if nothing is outstanding.
+ */
+long long send_window_timeout(const send_window *w, long long now, long long rto);
+
+/**
+ * Checks if every segment of the chunk has been acknowledged.
+ *
+ * @param w The send window.
+ *
+ * @return 1 if the transfer is complete, 0 otherwise.
+ */
+int send_window_done(const send_window *w);
+
+/**
+ * Sets up an estimator with no samples and a timeout of SEGMENT_TIMEOUT.
+ *
+ * @param r The estimator.
+ */
+void rtt_init(rtt_estimator *r);
+
+/**
+ * Adds a round trip time measurement and recomputes the timeout from
+ * the smoothed time and its deviation, which also ends any backoff.
+ *
+ * @param r The estimator.
+ * @param rtt The measured round trip time in microseconds.
+ */
+void rtt_sample(rtt_estimator *r, long long rtt);
+
+/**
+ * Doubles the timeout after it expired, up to RTO_MAX.
+ *
+ * @param r The estimator.
+ */
+void rtt_backoff(rtt_estimator *r);
+
+/**
+ * Works out the round trip time of a packet from the timestamp the
+ * other side echoed back.
+ *
+ * @param ts The echoed timestamp, the low 32 bits of current_time_usec.
+ * @param now The current time in microseconds.
+ *
+ * @return The round trip time in microseconds.
+ */
+long long rtt_from_echo(unsigned int ts, long long now);
+
+/**
+ * Sets up an empty receive window.
+ *
+ * @param w The window to initialize.
+ */
+void recv_window_init(recv_window *w);
+
+/**
+ * Stores a received segment until it can be delivered in order.
+ *
+ * @param w The receive window.
+ * @param seq The segment number.
+ * @param data The segment payload.
+ * @param len The length of data.
+ *
+ * @return 1 if the segment was new, 0 if it was a duplicate or beyond the window.
+ */
+int recv_window_store(recv_window *w, unsigned int seq, const char *data, int len);
+
+/**
+ * Checks if a segment is the next one due in order, so the caller can 
+ * consume it straight from the receive buffer and call recv_window_skip.
+ *
+ * @param w The receive window.
+ * @param seq The segment number.
+ *
+ * @return 1 if seq is at the base of the window and not yet held, 0 otherwise.
+ */
+int recv_window_in_order(const recv_window *w, unsigned int seq);
+
+/**
+ * Moves the window past the segment at its base after the caller 
+ * consumed it without storing it.
+ *
+ * @param w The receive window.
+ */
+void recv_window_skip(recv_window *w);
+
+/**
+ * Takes the next in order segment out of the window.
+ *
+ * @param w The receive window.
+ * @param data Set to point at the payload, valid until the next store.
+ * @param len Set to the payload length.
+ *
+ * @return 1 if a segment was delivered, 0 if the segment at base has not arrived.
+ */
+int recv_window_next(recv_window *w, char **data, int *len);
+
+/**
+ * Sets up an ack policy.
+ *
+ * @param a The policy.
+ * @param every Data packets per ack, at least 1.
+ * @param delay Longest an ack is held, in microseconds.
+ */
+void ack_policy_init(ack_policy *a, int every, long long delay);
+
+/**
+ * Counts a data packet and tells whether to ack now.
+ *
+ * @param a The policy.
+ * @param now The current time in microseconds.
+ * @param gap 1 if the packet was out of order, a duplicate, or filled a hole.
+ *
+ * @return 1 if an ack is due now, 0 if it may wait.
+ */
+int ack_policy_data(ack_policy *a, long long now, int gap);
+
+/**
+ * Gets the time until a held ack is due.
+ *
+ * @param a The policy.
+ * @param now The current time in microseconds.
+ *
+ * @return Microseconds until the ack is due, 0 if it is overdue, or -1 if none is held.
+ */
+long long ack_policy_timeout(const ack_policy *a, long long now);
+
+/**
+ * Records that an ack went out, covering every packet counted so far.
+ *
+ * @param a The policy.
+ */
+void ack_policy_sent(ack_policy *a);
+
+/**
+ * Records that a segment arrived without keeping its payload, for a
+ * receiver that puts the data in place itself. The window still tracks
+ * which segments it has, for the acks.
  *
- * @param buffer The buffer to parse into a mftp struct
+ * @param w The receive window.
+ * @param seq The segment number.
  *
- * @return A mftp_packet filled with data.
+ * @return 1 if the segment was new, 0 if it was a duplicate or beyond the window.
  */
-mftp_packet parse_dgram(unsigned char buffer[]);
+int recv_window_mark(recv_window *w, unsigned int seq);
 
 #endif
@@ -7,12 +7,57 @@ NAME
      server -- returns a formatted time to a requesting client
 
 SYNOPSIS
-     server [Port]
+     server [-a algorithm] [-C megabytes] [-c] [-g] [-i bytes] [-m] [-t workers] [-u] [-w window] [Port]
 
 DESCRIPTION  
      This program accepts the client port number as it's arguments,
      and while running, if contacted by a client, returns a chunk 
-     of a file to the user.
+     of a file to the user. Each worker thread binds its own socket
+     to the listening port with SO_REUSEPORT and the kernel spreads
+     clients over them. Every session is served from its worker's
+     socket and found by the connection id in the packet header, so no
+     socket or port is used per client. SIGINT or SIGTERM stops the
+     workers, which print their datagram counters on the way out,
+     and the server prints its cpu time.
+
+OPTIONS
+     -a algorithm
+                Congestion control that sizes each connection's send
+                window: reno, cubic, bbr, or fixed to always send the
+                full window. Defaults to cubic.
+     -C megabytes
+                Keep up to megabytes of file data in memory, split evenly
+                between the workers, in blocks of 64 packets. Packets of
+                a cached block go out with no read and no copy; the least
+                recently used blocks are dropped first. Files served with
+                -m are not cached. Off by default.
+     -c         Shard per core: pin each worker thread to its own CPU
+                from the process affinity mask. Without -t there is one
+                worker per allowed CPU. The kernel's flow hash keeps each
+                client on one worker, so workers share no locks.
+     -g         Send data with UDP segmentation offload: runs of full
+                data packets go to the kernel as one buffer per system
+                call and the kernel cuts them into datagrams. Falls back
+                to one datagram per packet if the kernel lacks UDP_SEGMENT.
+     -i bytes   Send files of up to bytes whole in the reply to a
+                client's request, with no window and no session kept, so
+                they arrive in one round trip. At most 32736, 0 turns it
+                off. Defaults to 4092, four packets.
+     -m         Map each requested file read-only and send packets straight
+                out of the page cache instead of reading them with pread.
+                Files must not be truncated while they are being served.
+     -t workers Number of event loop threads serving connections.
+                Each one owns a socket on the listening port and
+                multiplexes its sessions with epoll. Defaults to the
+                number of CPUs the process may run on.
+     -u         Use the io_uring engine: receives stay posted on a ring,
+                file reads are linked in front of the sends that carry
+                them, and a worker submits and sleeps in one system
+                call. Falls back to epoll and plain system calls if the
+                kernel has no io_uring.
+     -w window  Most unacknowledged data packets each connection may
+                have in flight (1 - 256), the congestion window never
+                grows past it. Defaults to 32.
 
 OPERANDS
      The only operand is a valid unused port number. If no port 
@@ -40,16 +85,21 @@ EXIT STATUS
 #include <netinet/in.h>  // struct sockaddr_in; byte ordering macros
 #include <arpa/inet.h>   // utility function prototypes
 #include <unistd.h>      // uni-standard lib.h
-#include <sys/select.h>  // used for select io multiplexing.
+#include <sys/epoll.h>   // used for epoll io multiplexing.
+#include <signal.h>      // SIGINT and SIGTERM shut the server down.
 #include <time.h>        // for the random numbers
-#include <sys/ioctl.h>   // allows nonblocking sockets.
 #include <pthread.h>     // allows for threaded server.
+#include <sched.h>       // cpu affinity for the -c option.
+#include <sys/resource.h> // cpu time used, printed on exit.
 
 // comment this out to turn on debug print statements.
 //#define NDEBUG NDEBUG
 
 #include "utils.h"
 #include "rudp.h"
+#include "session.h"
+#include "filecache.h"
+#include "catalog.h"
 
 #define SUCCESS   0
 #define FAILURE   1
@@ -58,382 +108,559 @@ EXIT STATUS
 //typedef struct sockaddr_in sockaddr_in;
 
 static uint8_t exit_status = SUCCESS;
-static uint8_t threadcount = 0;
 static int listening_port = 0;
-
-// handle a client request gets the data from the server and sends it.
-void *handle_client_request(void *clisock);
-
-// closes a client socket and removes it from an fd_set
-void close_client(int clisock, fd_set *master);
-
-
-struct client_ip_port {
-    unsigned long ip;
-    unsigned short port;
-};
-
-unsigned char *serialize_datastruct(struct client_ip_port p, unsigned char buffer[]);
-
-struct client_ip_port deserialize_datastruct(unsigned char buffer[]);
+static unsigned int window_size = DEFAULT_WINDOW;
+static int use_gso = FALSE;
+static int pin_workers = FALSE;
+static int use_uring = FALSE;
+static int map_files = FALSE;
+static size_t chunk_budget = 0;
+static long long inline_size = INLINE_SIZE;
+static const cc_ops *congestion = NULL;
+static catalog served_files;
+static file_cache open_files;
+
+// workers keep their state on the heap, so a small stack is plenty.
+#define WORKER_STACK (256 * 1024)
+
+// most events handled per epoll_wait() call.
+#define MAX_EVENTS 64
+
+// upper bound on the -t option.
+#define MAX_WORKERS 256
+
+// upper bound on the -C option, in megabytes.
+#define MAX_CHUNK_CACHE 65536
+
+// one event loop thread and the sessions it owns.
+typedef struct worker {
+    pthread_t thread;
+    int id;
+    int cpu;                   // cpu the worker is pinned to, -1 if not pinned.
+    int sock;                  // this worker's socket on the listening port.
+    int epfd;                  // epoll set of the socket and the stop pipe.
+    int pipefd[2];             // main thread writes to pipefd[1] to stop the worker.
+    rudp_batch *batch;         // reads and writes for every session of this worker.
+    chunk_cache *chunks;       // file blocks sent by this worker, NULL without -C.
+    session_table sessions;    // sessions by connection id and client address.
+    session **heap;            // sessions ordered by deadline.
+    int heapsize;
+    int heapcap;
+    unsigned long served;      // sessions created over the worker's lifetime.
+    unsigned long fast_resends;    // segments resent when later acks showed a hole.
+    unsigned long timeout_resends; // segments resent when their timeout ran out.
+    unsigned long window_cuts;     // congestion windows cut by a loss.
+} worker;
+
+// sets up a worker's socket, epoll set, pipe and batch. returns FALSE on failure.
+int worker_init(worker *w, int id, int portnum);
+
+// the event loop run by every worker thread.
+void *worker_loop(void *arg);
+
+// handles every datagram waiting on the worker socket.
+void worker_read(worker *w);
+
+// removes a session from its worker and destroys it.
+void worker_close(worker *w, session *s);
+
+// timer heap of sessions keyed on session.deadline.
+static int heap_push(worker *w, session *s);
+static void heap_remove(worker *w, session *s);
+static void heap_fix(worker *w, session *s);
 
 int main(int argc, char **argv) {
+  // the cpus this process may run on, one worker each by default.
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+     perror("Error: sched_getaffinity() failed ");
+     CPU_SET(0, &allowed);
+  }
+  long workercount = CPU_COUNT(&allowed);
   //initial error checking
-  if (argc != 2) {
+  opterr = FALSE;
+  for (;;) {
+     int option = getopt(argc, argv, "a:C:cgi:mt:uw:");
+     if (option == EOF) break;
+     switch (option) {
+        case 'a':
+           congestion = cc_find(optarg);
+           if (congestion == NULL) {
+              fprintf(stderr, "Error: Unknown congestion control: %s (reno, cubic, bbr or fixed).\n", optarg);
+              exit_status = FAILURE;
+              return FAILURE;
+           }
+           break;
+        case 'C':
+        {
+           char *endptr = NULL;
+           long mb = strtol(optarg, &endptr, 10);
+           if (*endptr != '\0' || mb < 0 || mb > MAX_CHUNK_CACHE) {
+              fprintf(stderr, "Error: Invalid chunk cache size: %s (0 - %d MB).\n", optarg, MAX_CHUNK_CACHE);
+              exit_status = FAILURE;
+              return FAILURE;
+           }
+           chunk_budget = (size_t)mb << 20;
+           break;
+        }
+        case 'c':
+           pin_workers = TRUE;
+           break;
+        case 'g':
+           use_gso = TRUE;
+           break;
+        case 'i':
+        {
+           char *endptr = NULL;
+           long bytes = strtol(optarg, &endptr, 10);
+           if (*endptr != '\0' || bytes < 0 || bytes > MAX_INLINE_SIZE) {
+              fprintf(stderr, "Error: Invalid inline size: %s (0 - %d bytes).\n", optarg, MAX_INLINE_SIZE);
+              exit_status = FAILURE;
+              return FAILURE;
+           }
+           inline_size = bytes;
+           break;
+        }
+        case 'm':
+           map_files = TRUE;
+           break;
+        case 't':
+        {
+           char *endptr = NULL;
+           long t = strtol(optarg, &endptr, 10);
+           if (*endptr != '\0' || t < 1 || t > MAX_WORKERS) {
+              fprintf(stderr, "Error: Invalid worker count: %s (1 - %d).\n", optarg, MAX_WORKERS);
+              exit_status = FAILURE;
+              return FAILURE;
+           }
+           workercount = t;
+           break;
+        }
+        case 'u':
+           use_uring = TRUE;
+           break;
+        case 'w':
+        {
+           char *endptr = NULL;
+           int w = (int)strtol(optarg, &endptr, 10);
+           if (*endptr != '\0' || w < 1 || w > MAX_WINDOW) {
+              fprintf(stderr, "Error: Invalid window size: %s (1 - %d).\n", optarg, MAX_WINDOW);
+              exit_status = FAILURE;
+              return FAILURE;
+           }
+           window_size = (unsigned int)w;
+           break;
+        }
+        default : 
+           fprintf(stderr, "Error: -%c: invalid option\n", optopt);
+           fprintf(stderr, "Usage: %s [-a algorithm] [-C megabytes] [-c] [-g] [-i bytes] [-m] [-t workers] [-u] [-w window] [PORT]\n", argv[0]);
+           exit_status = FAILURE;
+           return FAILURE;
+     }
+  }
+  if (argc - optind != 1) {
     fprintf(stderr, "Error: Include Listening Port Number.\n");
-    fprintf(stderr, "Usage: %s [PORT]\n", argv[0]);
+    fprintf(stderr, "Usage: %s [-a algorithm] [-C megabytes] [-c] [-g] [-i bytes] [-m] [-t workers] [-u] [-w window] [PORT]\n", argv[0]);
     exit_status = FAILURE;
     return FAILURE;
   }
   char *endptr = NULL;
-  int portnum = (int)strtol(argv[1], &endptr, 10);
+  int portnum = (int)strtol(argv[optind], &endptr, 10);
   if (0 == portnum || *endptr != '\0') {
      // error handling not valid port number
-     fprintf(stderr, "Error: Invalid Port Number: %s\n", argv[1]);
+     fprintf(stderr, "Error: Invalid Port Number: %s\n", argv[optind]);
      exit_status = FAILURE;
      return FAILURE;
   } else {
      DEBUGF("Server creates connections on port number: %d\n", portnum);
+     if (congestion == NULL) {
+        congestion = cc_find(CC_DEFAULT);
+     }
+     DEBUGF("Send window: %u packets, %s congestion control\n", window_size, congestion->name);
+     DEBUGF("Workers: %ld\n", workercount);
+     // each worker caches its own share of the blocks.
+     chunk_budget /= workercount;
      listening_port = portnum;
   }
 
-  //create socket for the server 
-  int serv_socket = socket(AF_INET, SOCK_DGRAM, 0);
-  if (serv_socket < 0) {
-     perror("ERROR: SOCKET CORRUPT ");
-     return errno;
-  } else {
-     DEBUGF("Server Socket: %d\n", serv_socket);
+  // the workers inherit a blocked SIGINT and SIGTERM, the main thread
+  // collects them with sigwait() and shuts the workers down.
+  sigset_t stopsigs;
+  sigemptyset(&stopsigs);
+  sigaddset(&stopsigs, SIGINT);
+  sigaddset(&stopsigs, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stopsigs, NULL);
+
+  // index the served directory once, then every worker opens files
+  // through one cache.
+  if (!catalog_init(&served_files)) {
+     return FAILURE;
   }
-
-  sockaddr_in my_serv;
-  my_serv.sin_family = AF_INET;
-  my_serv.sin_port = htons(portnum);
-  my_serv.sin_addr.s_addr = htonl(INADDR_ANY);
-  memset(my_serv.sin_zero, '\0', sizeof(my_serv.sin_zero));
-  sockaddr_in *my_serv_ref = &my_serv;
-  int er_chk = bind(serv_socket, (sockaddr*)my_serv_ref, sizeof(my_serv));
-  if (er_chk < 0) {
-     perror("Error: Socket to Address bind failure ");
-     return errno;
-  } else {
-     DEBUGF("Bind Success.\n");
+  if (!file_cache_init(&open_files, &served_files, FILE_CACHE_SIZE, map_files)) {
+     catalog_destroy(&served_files);
+     return FAILURE;
   }
-
-  /* 
-  // test serialization
-  mftp_packet packet;
-  packet.seq = 123192;
-  packet.flag = 95823;
-  char *buf = "DATA TO SEND TEST";
-  unsigned char buffer[2048];
-  memcpy (packet.data, buf, 19);
-  DEBUGF("%s, %d, %d\n", packet.data, packet.flag, packet.seq);
-  bzero(buffer, sizeof(buffer));
-  serialize_packet(packet, buffer);
-  DEBUGF("%s\n", buffer);
-  mftp_packet ret = deserialize_packet(buffer);
-  DEBUGF("%s, %d, %d\n", ret.data, ret.flag, ret.seq);
-  */
-
-  while (1) {
-      DEBUGF("Main thread waiting for connections on listening port.\n");
-      sockaddr_in client;
-      sockaddr_in *cli_ref = &client;
-      uint clen = (uint)sizeof(client);
-      char buffer[4];
-      bzero(buffer, sizeof(buffer));
-      int rc = recvfrom(serv_socket, buffer, sizeof(buffer),
-                        0, (sockaddr*)cli_ref, &clen);
-      if (rc == -1) {
-          fprintf(stderr, "Error: recvfrom() failed.\n");
-      } else {
-          DEBUGF("recieved from :%s, on port: %hu\n", inet_ntoa(client.sin_addr), client.sin_port);
+  worker *workers = calloc(workercount, sizeof(worker));
+  if (workers == NULL) {
+     fprintf(stderr, "Error: malloc() of workers failed.\n");
+     file_cache_destroy(&open_files);
+     catalog_destroy(&served_files);
+     return FAILURE;
+  }
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, WORKER_STACK);
+  long started = 0;
+  int cpu = -1;
+  for (; started < workercount; ++started) {
+      if (!worker_init(&workers[started], (int)started, portnum)) {
+          break;
       }
-      
-      // set up thread for new connection
-      pthread_t thread_ID; 
-      struct client_ip_port cliinfo;
-      cliinfo.ip = client.sin_addr.s_addr;
-      cliinfo.port = client.sin_port;
-      unsigned char infobuffer[(sizeof(cliinfo))];
-      bzero(infobuffer, sizeof(infobuffer));
-      serialize_datastruct(cliinfo, infobuffer);
-
-      // Create the thread, passing &value for the argument.
-      threadcount++;
-      int i = pthread_create(&thread_ID, NULL, handle_client_request, 
-                                                             (void *)infobuffer);
-      if (i == EAGAIN) {
-          fprintf(stderr, "Error: Insufficient resources to create another \
-                           thread,  or  a  system imposed  limit  on  \
-                           the  number of threads was encountered.  \
-                           The latter case  may  occur  in  two  ways:\
-                           the  RLIMIT_NPROC  soft resource  limit  (set \
-                           via setrlimit(2)), which limits the number of \
-                           process for a real user ID, was reached; \
-                           or the kernel's system-wide   limit   on  \
-                           the  number  of  threads,  /proc/sys/kernel\
-                           /threads-max, was reached.\n");
-      } else if (i == EINVAL) {
-          fprintf(stderr, "Error: Invalid settings in attr.\n");
-      } else if (i == EPERM) {
-          fprintf(stderr, "Error: No permission to set the scheduling\
-                           policy and parameters specified in attr.\n");
+      workers[started].cpu = -1;
+      if (pin_workers) {
+          // next allowed cpu, wrapping if there are more workers than cpus.
+          do {
+              cpu = (cpu + 1) % CPU_SETSIZE;
+          } while (!CPU_ISSET(cpu, &allowed));
+          cpu_set_t one;
+          CPU_ZERO(&one);
+          CPU_SET(cpu, &one);
+          if (pthread_attr_setaffinity_np(&attr, sizeof(one), &one) == 0) {
+              workers[started].cpu = cpu;
+          }
+      }
+      int i = pthread_create(&workers[started].thread, &attr, worker_loop,
+                             (void *)&workers[started]);
+      if (i != 0) {
+          fprintf(stderr, "Error: pthread_create() failed: %s.\n", strerror(i));
+          break;
       }
   }
+  pthread_attr_destroy(&attr);
+  if (started == 0) {
+      free(workers);
+      file_cache_destroy(&open_files);
+      catalog_destroy(&served_files);
+      return FAILURE;
+  }
 
-  // program never gets here, but if there was an exit 
-  // server this would close the server. 
-  close(serv_socket);
+  int sig = 0;
+  sigwait(&stopsigs, &sig);
+  DEBUGF("Signal %d, stopping %ld workers.\n", sig, started);
+  for (long i = 0; i < started; ++i) {
+      if (write(workers[i].pipefd[1], "", 1) != 1) {
+          perror("Error: stopping worker failed ");
+      }
+  }
+  for (long i = 0; i < started; ++i) {
+      pthread_join(workers[i].thread, NULL);
+  }
+  free(workers);
+  print_file_cache_stats(&open_files);
+  print_catalog_stats(&served_files);
+  file_cache_destroy(&open_files);
+  catalog_destroy(&served_files);
+
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+      printf("Server: %ld.%06ld s user %ld.%06ld s system, %ld voluntary %ld involuntary context switches\n",
+             (long)usage.ru_utime.tv_sec, (long)usage.ru_utime.tv_usec,
+             (long)usage.ru_stime.tv_sec, (long)usage.ru_stime.tv_usec,
+             usage.ru_nvcsw, usage.ru_nivcsw);
+  }
 
   return exit_status;
 }
 
+int worker_init(worker *w, int id, int portnum) {
+    w->id = id;
+
+    //create socket for the worker, every worker binds the listening port.
+    w->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (w->sock < 0) {
+        perror("ERROR: SOCKET CORRUPT ");
+        return FALSE;
+    } else {
+        DEBUGF("Worker %d Socket: %d\n", id, w->sock);
+    }
+    int on = 1;
+    if (setsockopt(w->sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        perror("Error: SO_REUSEPORT failed ");
+        close(w->sock);
+        return FALSE;
+    }
+    sockaddr_in my_serv;
+    my_serv.sin_family = AF_INET;
+    my_serv.sin_port = htons(portnum);
+    my_serv.sin_addr.s_addr = htonl(INADDR_ANY);
+    memset(my_serv.sin_zero, '\0', sizeof(my_serv.sin_zero));
+    if (bind(w->sock, (sockaddr*)&my_serv, sizeof(my_serv)) < 0) {
+        perror("Error: Socket to Address bind failure ");
+        close(w->sock);
+        return FALSE;
+    }
+
+    w->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (w->epfd < 0) {
+        perror("Error: epoll_create1() failed ");
+        close(w->sock);
+        return FALSE;
+    }
+    if (pipe(w->pipefd) < 0) {
+        perror("Error: pipe() failed ");
+        close(w->epfd);
+        close(w->sock);
+        return FALSE;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = w->sock;
+    int rc = epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->sock, &ev);
+    ev.data.fd = w->pipefd[0];
+    if (rc < 0 || epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->pipefd[0], &ev) < 0) {
+        perror("Error: epoll_ctl() failed ");
+        close(w->pipefd[0]);
+        close(w->pipefd[1]);
+        close(w->epfd);
+        close(w->sock);
+        return FALSE;
+    }
+    w->batch = malloc(sizeof(rudp_batch));
+    if (w->batch == NULL || !session_table_init(&w->sessions)) {
+        fprintf(stderr, "Error: malloc() of worker state failed.\n");
+        free(w->batch);
+        close(w->pipefd[0]);
+        close(w->pipefd[1]);
+        close(w->epfd);
+        close(w->sock);
+        return FALSE;
+    }
+    batch_init(w->batch, w->sock);
+    if (use_gso && !batch_enable_gso(w->batch)) {
+        DEBUGF("GSO unavailable, sending one datagram per packet.\n");
+    }
+    if (use_uring) {
+        // the ring also watches the stop pipe so one wait covers both.
+        if (!batch_enable_uring(w->batch) || !batch_watch(w->batch, w->pipefd[0])) {
+            fprintf(stderr, "Warning: io_uring unavailable (%s), worker %d uses epoll.\n",
+                    strerror(errno), id);
+            batch_destroy(w->batch);
+        }
+    }
+    w->chunks = NULL;
+    if (chunk_budget > 0) {
+        w->chunks = malloc(sizeof(chunk_cache));
+        if (w->chunks == NULL || !chunk_cache_init(w->chunks, chunk_budget)) {
+            fprintf(stderr, "Warning: worker %d runs without a chunk cache.\n", id);
+            free(w->chunks);
+            w->chunks = NULL;
+        }
+    }
+    return TRUE;
+}
 
-void *handle_client_request(void *c) {
-    DEBUGF("New pthread created to handle client.\n");
-
-    struct client_ip_port cliinfo = deserialize_datastruct((unsigned char *)c);
-
-    // get client port and address from struct c
-    sockaddr_in client;
-    uint clen = (uint)sizeof(client);
-    client.sin_family = AF_INET;
-    client.sin_addr.s_addr = (unsigned long)cliinfo.ip;
-    client.sin_port = (unsigned short)cliinfo.port; 
-    DEBUGF("client address: %s, port: %hu\n", inet_ntoa(client.sin_addr), client.sin_port);
- 
-   //create new socket for the server to send back to this client. 
-   int clisock = socket(AF_INET, SOCK_DGRAM, 0);
-   if (clisock < 0) {
-      perror("ERROR: SOCKET CORRUPT ");
-      int ptr = FAILURE;
-      pthread_exit((void*)&ptr);
-   } else {
-      DEBUGF("Server Socket: %d\n", clisock);
-   }
- 
-   // bind the new socket to a different port than the listening port.
-   sockaddr_in serv_sock;
-   serv_sock.sin_family = AF_INET;
-   serv_sock.sin_port = htons(0);
-   serv_sock.sin_addr.s_addr = htonl(INADDR_ANY);
-   memset(serv_sock.sin_zero, '\0', sizeof(serv_sock.sin_zero));
-   sockaddr_in *serv_sock_ref = &serv_sock;
-   int er_chk = bind(clisock, (sockaddr*)serv_sock_ref, sizeof(serv_sock));
-   if (er_chk < 0) {
-      perror("Error: Socket to Address bind failure ");
-      int ptr = FAILURE;
-      pthread_exit((void*)&ptr);
-   } else {
-      DEBUGF("Bind Success on port:%hu.\n", serv_sock.sin_port);
-   }
-
-   // create MAIN timeout for if the connection goes dead for a while then
-   // exit the thread. here i can use alarm() and signal(SIGARLRM, handler)
-   // or the timer method from the forums.
-
-   // create fd_set to use for the timeout. 
-   fd_set master;            // master list of file descriptors.
-   FD_ZERO(&master);
-   FD_SET(clisock, &master); // add listening socket to master list.
-
-   // send first packet to client on new port so it knows to start 
-   // sending here.
-   send_ack(1, clisock, client, clen);
- 
-   // loop forever until the exit or done message is given.
-   // if the timeval tv expires in select a retranmission should occur.
-   int last_packet = ACK;
-   int last_packet_seq = 1;
-   mftp_packet last_p;
-   char state = 1;       
-   FILE *fileserv = NULL;
-   char filename[256];
-   int chunksize = 0;
-   int bytessent = 0;
-   int offset = 0;
-   int breakloop = 0;
-   int connection_timeouts = 0;
-   while (1) {
-
-       DEBUGF("Posix thread waiting on select().\n");
-       struct timeval tv = {0,0};
-       tv.tv_sec = 5;
-       fd_set read_fds = master;
-
-       if (breakloop) break; // break from select if done transmitting.
-
-       if (select(clisock + 1, &read_fds, NULL, NULL, &tv) < 0) {
-          fprintf(stderr, "Error: select() failed.\n");
-          if (errno == EBADF) {
-             fprintf(stderr, "Error: select() failed due to bad descriptor.\n");
-          }
-          exit_status = FAILURE;
-       }
-       DEBUGF("select() has returned.\n");
-
-       if (FD_ISSET(clisock, &read_fds)) {
-          // process client response.
-          unsigned char buffer[1100];
-          bzero(buffer, sizeof(buffer));
-          int result = recvfrom(clisock, buffer, sizeof(buffer),
-                        0, (sockaddr*)&client, &clen);
-          if (result == -1) {
-              // handle error
-              perror("Error: recvfrom() failed. ");
-              int ptr = FAILURE;
-              pthread_exit((void*)&ptr);
-          } else {
-              mftp_packet p = parse_dgram(buffer);
-              DEBUGF("data = %s, flag = %d, seq = %d, state = %d.\n", p.data, p.flag, p.seq, state);
-              // process packet
-              switch (state) {
-                case 1: // send ack for if valid file. otherwise error
-                {
-                    // search for file in directory.
-                    fileserv = retrieve_file(p.data, "r");
-                    // if no such file then break out and serv new client.
-                    if (fileserv == NULL) {
-                       send_error(p.seq, clisock, client, clen);
-                       close_client(clisock, &master);
-                       int ptr = FAILURE;
-                       pthread_exit((void*)&ptr);
-                    } else {
-                       DEBUGF("File: %s requested.\n", p.data);
-                       sprintf(filename, "%s", p.data);
-                       send_ack(p.seq, clisock, client, clen);
-                       last_packet = ACK;
-                       last_packet_seq = p.seq;
-                       state = 2;
-                    }
-                    break;
-                }
-                case 2: // parse get connect num and send ack.
-                {
-                    // parse connect num
-                    DEBUGF("Getting number of connections.\n");
-                    char *endptr = NULL;
-                    int cnum = (int)strtol(p.data, &endptr, 10);
-                    if (*endptr != '\0') {
-                       fprintf(stderr, "Error: Invalid chunksize value: %s.\n", p.data);
-                       send_error(1, clisock, client, clen);
-                       close_client(clisock, &master);
-                       int ptr = FAILURE;
-                       pthread_exit((void*)&ptr);
-                    } else {
-                       int filesize = get_file_size(fileserv);
-                       chunksize = filesize / cnum;
-                       DEBUGF("%d connections => chunksize = %d\n", cnum, chunksize);
-                       send_ack(p.seq, clisock, client, clen);
-                       last_packet = ACK;
-                       last_packet_seq = p.seq;
-                       state = 3;
-                    }
-                    break;
-                }
-                case 3: // send ack for thet starting point of the file
-                {
-                    // parse offset value.
-                    char *endptr = NULL;
-                    offset = (int)strtol(p.data, &endptr, 10);
-                    if (*endptr != '\0') {
-                       fprintf(stderr, "Error: Invalid file offset value: %s.\n", p.data);
-                       send_error(1, clisock, client, clen);
-                       close_client(clisock, &master);
-                       int ptr = FAILURE;
-                       pthread_exit((void*)&ptr);
-                    } else {
-                       DEBUGF("Filename: %s. Chunksize: %d. Offset: %d.\n", filename, chunksize, offset);
-                       send_ack(p.seq, clisock, client, clen);
-                       last_packet = ACK;
-                       last_packet_seq = p.seq;
-                       state = 4;
-                    }
-                    break;
-                }
-                case 4: // receive ack and send next data.
-                {
-                    if (bytessent < chunksize) {
-                        mftp_packet data = get_file_chunk(chunksize*offset + bytessent, fileserv, p.seq, chunksize, offset);
-
-                        int wc = send_dgram(clisock, &client, clen, data);
-                        if (wc == 0) {
-                            fprintf(stderr, "Error: sendto()) error.\n");
-                        } else {
-                            if ((chunksize - bytessent) > 1023) {
-                                bytessent += 1023;
-                            } else {
-                               bytessent += (chunksize - bytessent);
-                            }
-                            DEBUGF("Write Success (data) in state 4, %d, out of %d.\n", chunksize*offset + bytessent, chunksize*(offset+1));
-                            last_p = data;
-                            last_packet_seq = p.seq;
-                        }
-                    } else {
-                        state = 5;
-                    }
-                    break;
+void *worker_loop(void *arg) {
+    worker *w = (worker *)arg;
+    DEBUGF("Worker %d started on cpu %d.\n", w->id, w->cpu);
+    struct epoll_event events[MAX_EVENTS];
+    int running = TRUE;
+    while (running) {
+        // sleep until the earliest session deadline.
+        long long wait = -1;
+        if (w->heapsize > 0) {
+            wait = w->heap[0]->deadline - current_time_usec();
+            if (wait < 0) wait = 0;
+        }
+        if (w->batch->ring != NULL) {
+            int ready = batch_wait(w->batch, wait);
+            if (ready < 0) {
+                perror("Error: io_uring_enter() failed ");
+                exit_status = FAILURE;
+                break;
+            }
+            if (ready) {
+                worker_read(w);
+            }
+            if (w->batch->watched) {
+                running = FALSE;
+            }
+        } else {
+            int timeout = wait < 0 ? -1 : (int)((wait + 999) / 1000);
+            int n = epoll_wait(w->epfd, events, MAX_EVENTS, timeout);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                perror("Error: epoll_wait() failed ");
+                exit_status = FAILURE;
+                break;
+            }
+            for (int i = 0; i < n; ++i) {
+                if (events[i].data.fd == w->sock) {
+                    worker_read(w);
+                } else {
+                    running = FALSE;
                 }
-                case 5: // done with transmission
-                    send_ack(p.seq, clisock, client, clen);
-                    last_packet = ACK;
-                    last_packet_seq = p.seq;
-                    breakloop = 1;
-                    break;
-                default: // no default case.
-                    break;
-              }
-          }
-       } else {
-          // handle timeout
-          // retransmit last packet.
-          connection_timeouts++;
-          if (connection_timeouts > 5) {
-              breakloop = 1;
-          }
-          if (last_packet == ACK) {
-             // retransmit ack
-             send_ack(last_packet_seq, clisock, client, clen);
-          } else {
-              int wc = send_dgram(clisock, &client, clen, last_p);
-              if (wc == 0) {
-                  fprintf(stderr, "Error: sendto()) error.\n");
-              } else {
-                  DEBUGF("Write Success (data) resend*, %d.\n", bytessent);
-              }
-          }
-       }
-       if (breakloop) {
-           break;
-       }
-   }
-   close_client(clisock, &master);  
-   pthread_exit( NULL );
+            }
+        }
+
+        // run every timer that is due.
+        long long now = current_time_usec();
+        while (w->heapsize > 0 && w->heap[0]->deadline <= now) {
+            session *s = w->heap[0];
+            if (session_on_timer(s, w->batch, now)) {
+                session_update_deadline(s);
+                heap_fix(w, s);
+            } else {
+                worker_close(w, s);
+            }
+        }
+
+        // everything queued this pass goes out in one system call.
+        batch_flush(w->batch);
+    }
+
+    while (w->heapsize > 0) {
+        worker_close(w, w->heap[0]);
+    }
+    char who[64];
+    if (w->cpu >= 0) {
+        sprintf(who, "Worker %d cpu %d (%lu sessions)", w->id, w->cpu, w->served);
+    } else {
+        sprintf(who, "Worker %d (%lu sessions)", w->id, w->served);
+    }
+    print_batch_stats(w->batch, who);
+    printf("%s: %lu fast resends, %lu timeout resends, %lu window cuts\n", who, w->fast_resends,
+           w->timeout_resends, w->window_cuts);
+    batch_destroy(w->batch);
+    free(w->batch);
+    if (w->chunks != NULL) {
+        print_chunk_cache_stats(w->chunks, who);
+        chunk_cache_destroy(w->chunks);
+        free(w->chunks);
+    }
+    session_table_destroy(&w->sessions);
+    free(w->heap);
+    close(w->pipefd[0]);
+    close(w->pipefd[1]);
+    close(w->epfd);
+    close(w->sock);
+    return NULL;
+}
+
+void worker_read(worker *w) {
+    int result = batch_recv(w->batch);
+    if (result == -1) {
+        perror("Error: recvmmsg() failed. ");
+        return;
+    }
+    for (int i = 0; i < result; ++i) {
+        mftp_view p;
+        sockaddr_in from;
+        if (!batch_view(w->batch, i, &p, &from)) {
+            DEBUGF("Dropping malformed datagram of %d bytes.\n", w->batch->seglen[i]);
+            continue;
+        }
+        session *s = session_table_find(&w->sessions, p.conn, &from);
+        if (s == NULL) {
+            // only the opening ack or a request starts a session, never
+            // a late ack of data.
+            if (p.conn == 0 || !((p.flag == ACK && p.seq == 1 && p.opts == 0) || p.flag == REQ)) {
+                DEBUGF("Dropping packet of unknown connection %u.\n", p.conn);
+                continue;
+            }
+            s = session_create(w->sock, &from, p.conn, window_size, &open_files, w->chunks,
+                               inline_size, congestion);
+            if (s == NULL) {
+                continue;
+            }
+            if (!heap_push(w, s)) {
+                fprintf(stderr, "Error: could not add session.\n");
+                session_destroy(s, w->batch);
+                continue;
+            }
+            session_table_insert(&w->sessions, s);
+            w->served++;
+        }
+        if (session_on_packet(s, w->batch, &p)) {
+            session_update_deadline(s);
+            heap_fix(w, s);
+        } else {
+            worker_close(w, s);
+        }
+    }
 }
 
-void close_client(int clisock, fd_set *master) {
-   DEBUGF("closing client socket: %d.\n", clisock);
-   close(clisock);
-   FD_CLR(clisock, master);
+void worker_close(worker *w, session *s) {
+    w->fast_resends += s->fast_resends;
+    w->timeout_resends += s->timeout_resends;
+    w->window_cuts += s->cc.reductions;
+    heap_remove(w, s);
+    session_table_remove(&w->sessions, s);
+    session_destroy(s, w->batch);
 }
 
+static void heap_swap(worker *w, int i, int j) {
+    session *tmp = w->heap[i];
+    w->heap[i] = w->heap[j];
+    w->heap[j] = tmp;
+    w->heap[i]->heapidx = i;
+    w->heap[j]->heapidx = j;
+}
+
+static void heap_up(worker *w, int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (w->heap[parent]->deadline <= w->heap[i]->deadline) break;
+        heap_swap(w, i, parent);
+        i = parent;
+    }
+}
 
+static void heap_down(worker *w, int i) {
+    for (;;) {
+        int least = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < w->heapsize && w->heap[left]->deadline < w->heap[least]->deadline) {
+            least = left;
+        }
+        if (right < w->heapsize && w->heap[right]->deadline < w->heap[least]->deadline) {
+            least = right;
+        }
+        if (least == i) break;
+        heap_swap(w, i, least);
+        i = least;
+    }
+}
+
+static int heap_push(worker *w, session *s) {
+    if (w->heapsize == w->heapcap) {
+        int cap = w->heapcap ? w->heapcap * 2 : 64;
+        session **heap = realloc(w->heap, cap * sizeof(session *));
+        if (heap == NULL) {
+            return FALSE;
+        }
+        w->heap = heap;
+        w->heapcap = cap;
+    }
+    s->heapidx = w->heapsize;
+    w->heap[w->heapsize++] = s;
+    heap_up(w, s->heapidx);
+    return TRUE;
+}
 
-unsigned char *serialize_datastruct(struct client_ip_port p, unsigned char buffer[]) {
-    buffer = serialize_int(buffer, (int)p.ip);
-    buffer = serialize_int(buffer, (int)p.port);
-    return buffer;
+static void heap_remove(worker *w, session *s) {
+    int i = s->heapidx;
+    if (i < 0) return;
+    w->heapsize--;
+    if (i != w->heapsize) {
+        heap_swap(w, i, w->heapsize);
+        heap_fix(w, w->heap[i]);
+    }
+    s->heapidx = -1;
 }
 
-struct client_ip_port deserialize_datastruct(unsigned char buffer[]) {
-    unsigned int ip = 0;
-    unsigned int port = 0;
-    buffer = deserialize_int(buffer, &ip);
-    buffer = deserialize_int(buffer, &port);
-    struct client_ip_port p;
-    p.ip = (unsigned long)ip;
-    p.port = (unsigned short)port;
-    return p;
+static void heap_fix(worker *w, session *s) {
+    heap_up(w, s->heapidx);
+    heap_down(w, s->heapidx);
 }
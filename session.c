@@ -0,0 +1,541 @@
+// File: session.c
+// Created October 17, 2026
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// comment this out to turn on debug prints.
+//#define NDEBUG NDEBUG
+
+#include "session.h"
+#include "utils.h"
+#include "rudp.h"
+
+// queues one segment of the chunk and records it in the send window.
+static void send_segment(session *s, rudp_batch *batch, unsigned int seq);
+
+// resends every segment whose ack is overdue.
+static void resend_expired(session *s, rudp_batch *batch, long long now);
+
+// tallies the last ack and resends every segment it showed lost.
+// returns how many.
+static int resend_lost(session *s, rudp_batch *batch);
+
+// acks the last control packet again, with the file's metadata or the
+// chunk range when it is the ack of the filename or the chunk index.
+static void send_reply(session *s);
+
+// acks a REQ packet with the file's metadata and the chunk range.
+static void send_request_reply(session *s, unsigned int seq);
+
+// opens the requested file, an error is sent if it is not served.
+static int open_file(session *s, rudp_batch *batch, const mftp_view *p, const char *name);
+
+// queues the reply to a REQ and, for chunk 0, the whole file behind it.
+static void send_inline(session *s, rudp_batch *batch, unsigned int seq);
+
+// works out the chunk's range and sets up the send window for it.
+static void plan_chunk(session *s);
+
+// sends what the window allows, and the done once all is acknowledged.
+static void fill_window(session *s, rudp_batch *batch);
+
+// spreads connection id and client address over the table buckets.
+static unsigned int session_hash(unsigned int conn, const sockaddr_in *from);
+
+session *session_create(int sock, const sockaddr_in *client, unsigned int conn,
+                        unsigned int window, file_cache *files, chunk_cache *chunks,
+                        long long inline_size, const cc_ops *cc) {
+   session *s = malloc(sizeof(session));
+   if (s == NULL) {
+      fprintf(stderr, "Error: malloc() of session failed.\n");
+      return NULL;
+   }
+   bzero(s, sizeof(session));
+   s->sock = sock;
+   s->conn = conn;
+   s->client = *client;
+   s->clen = (unsigned int)sizeof(s->client);
+   DEBUGF("client address: %s, port: %hu, connection: %u\n", inet_ntoa(s->client.sin_addr),
+          s->client.sin_port, conn);
+
+   s->state = 1;
+   s->last_packet = ACK;
+   s->last_packet_seq = 1;
+   s->last_heard = current_time_usec();
+   s->heapidx = -1;
+   s->fileslot = -1;
+   s->files = files;
+   s->chunks = chunks;
+   s->inline_size = inline_size;
+   send_window_init(&s->window, window, 0);
+   rtt_init(&s->rtt);
+   cc_init(&s->cc, cc, window);
+   session_update_deadline(s);
+   return s;
+}
+
+int session_on_timer(session *s, rudp_batch *batch, long long now) {
+   if (now - s->last_heard >= IDLE_TIMEOUT) {
+      // handle timeout
+      // retransmit last packet.
+      s->last_heard = now;
+      s->connection_timeouts++;
+      if (s->connection_timeouts > 5 || s->state == 5) {
+         // in state 5 a quiet client already has the done packet.
+         return 0;
+      } else if (s->last_packet == ACK) {
+         // retransmit ack
+         send_reply(s);
+      }
+   }
+
+   // selectively resend data segments whose ack is overdue.
+   if (s->transferring) {
+      resend_expired(s, batch, now);
+   }
+   return 1;
+}
+
+long long session_update_deadline(session *s) {
+   s->deadline = s->last_heard + IDLE_TIMEOUT;
+   if (s->transferring) {
+      // wake up early if a data segment is due for a resend.
+      long long now = current_time_usec();
+      long long wait = send_window_timeout(&s->window, now, s->rtt.rto);
+      if (wait >= 0 && now + wait < s->deadline) {
+         s->deadline = now + wait;
+      }
+   }
+   return s->deadline;
+}
+
+void session_destroy(session *s, rudp_batch *batch) {
+   DEBUGF("closing connection: %u. srtt %lld us, rto %lld us, %lu samples, "
+          "%lu fast and %lu timeout resends, %s cwnd %.1f after %lu cuts.\n", s->conn,
+          s->rtt.srtt, s->rtt.rto, s->rtt.samples, s->fast_resends, s->timeout_resends,
+          s->cc.ops->name, s->cc.cwnd, s->cc.reductions);
+   batch_remove_file(batch, s->fileslot);
+   if (s->file != NULL && s->file->map != NULL) {
+      // queued packets may still point into the mapping.
+      batch_drain(batch);
+   }
+   file_cache_release(s->files, s->file);
+   free(s);
+}
+
+int session_on_packet(session *s, rudp_batch *batch, const mftp_view *p) {
+   s->last_heard = current_time_usec();
+   s->connection_timeouts = 0;
+   if (p->flag == DONE) {
+      // the client has the file already and ends the connection early.
+      DEBUGF("Client closed connection: %u.\n", s->conn);
+      return 0;
+   }
+   if (p->flag == REQ && s->requested) {
+      // the client did not get our reply, the data may be flowing already.
+      send_request_reply(s, p->seq);
+      return 1;
+   }
+   if (p->flag == DATA && s->last_packet == ACK && p->seq == (unsigned int)s->last_packet_seq) {
+      // the field we just took again, our ack was lost.
+      send_reply(s);
+      return 1;
+   }
+   if ((s->state == 2 || s->state == 3) && p->flag != DATA) {
+      // a late duplicate of an earlier packet, not the next field.
+      return 1;
+   }
+   switch (s->state) {
+     case 1: // send ack for if valid file. otherwise error
+     {
+         if (p->flag == REQ) {
+            // everything the handshake would ask for, in one packet.
+            int window = 0;
+            int name = 0;
+            if (sscanf(p->data, "%d %d %d %n", &s->cnum, &s->offset, &window, &name) != 3
+                || name == 0 || s->cnum < 1 || s->offset < 0 || s->offset >= s->cnum) {
+               fprintf(stderr, "Error: Invalid request: %s.\n", p->data);
+               send_error(p->seq, s->conn, s->sock, s->client, s->clen);
+               return 0;
+            }
+            if (!open_file(s, batch, p, p->data + name)) {
+               return 0;
+            }
+            if (s->inline_size > 0 && s->file->size <= s->inline_size) {
+               // small enough for one flush, no chunks and no state kept.
+               send_inline(s, batch, p->seq);
+               return 0;
+            }
+            if (window > 0 && (unsigned int)window < s->window.size) {
+               // never more in flight than the client can hold.
+               s->window.size = (unsigned int)window;
+            }
+            plan_chunk(s);
+            s->requested = 1;
+            s->state = 4;
+            send_request_reply(s, p->seq);
+            s->transferring = 1;
+            fill_window(s, batch);
+            break;
+         }
+         if (p->flag != DATA) {
+            // the opening packet again, our first ack was lost.
+            send_ack(1, s->conn, s->sock, s->client, s->clen);
+            break;
+         }
+         if (!open_file(s, batch, p, p->data)) {
+            return 0;
+         }
+         s->last_packet = ACK;
+         s->last_packet_seq = p->seq;
+         s->state = 2;
+         send_reply(s);
+         break;
+     }
+     case 2: // parse get connect num and send ack.
+     {
+         // parse connect num
+         DEBUGF("Getting number of connections.\n");
+         char *endptr = NULL;
+         int cnum = (int)strtol(p->data, &endptr, 10);
+         if (*endptr != '\0' || cnum < 1) {
+            fprintf(stderr, "Error: Invalid chunksize value: %s.\n", p->data);
+            send_error(1, s->conn, s->sock, s->client, s->clen);
+            return 0;
+         }
+         s->cnum = cnum;
+         DEBUGF("%d connections => chunksize = %lld\n", cnum, s->file->size / cnum);
+         send_ack(p->seq, s->conn, s->sock, s->client, s->clen);
+         s->last_packet = ACK;
+         s->last_packet_seq = p->seq;
+         s->state = 3;
+         break;
+     }
+     case 3: // send ack for thet starting point of the file
+     {
+         // parse offset value.
+         char *endptr = NULL;
+         s->offset = (int)strtol(p->data, &endptr, 10);
+         if (*endptr != '\0' || s->offset < 0 || s->offset >= s->cnum) {
+            fprintf(stderr, "Error: Invalid file offset value: %s.\n", p->data);
+            send_error(1, s->conn, s->sock, s->client, s->clen);
+            return 0;
+         }
+         plan_chunk(s);
+         s->last_packet = ACK;
+         s->last_packet_seq = p->seq;
+         s->state = 4;
+         send_reply(s);
+         break;
+     }
+     case 4: // receive acks and keep the send window full.
+     {
+         if (p->flag == START) {
+             if (!s->transferring) {
+                 DEBUGF("Client started transfer of %u segments.\n", s->window.total);
+             }
+             s->transferring = 1;
+         } else if (p->flag == ACK && s->transferring) {
+             int acked = 0;
+             if (p->opts & OPT_SACK) {
+                 // the client's whole window in one ack.
+                 acked = send_window_sack(&s->window, p->seq, p->data, p->len);
+             } else {
+                 acked = send_window_ack(&s->window, p->seq);
+             }
+             if (acked) {
+                 if (p->opts & OPT_TS) {
+                     long long rtt = rtt_from_echo(p->ts, s->last_heard);
+                     rtt_sample(&s->rtt, rtt);
+                     cc_rtt_sample(&s->cc, rtt, s->last_heard);
+                 }
+                 cc_ack(&s->cc, (unsigned int)acked, s->last_heard);
+                 // acked past a hole, fill it before sending new data.
+                 if (resend_lost(s, batch) > 0) {
+                     cc_loss(&s->cc, FALSE, s->last_heard);
+                 }
+                 s->window.size = cc_window(&s->cc);
+             }
+         } else {
+             break;
+         }
+         fill_window(s, batch);
+         break;
+     }
+     case 5: // done with transmission, client missed the done.
+         send_done(s->last_packet_seq, s->conn, s->sock, s->client, s->clen);
+         break;
+     default: // no default case.
+         break;
+   }
+   return 1;
+}
+
+static int open_file(session *s, rudp_batch *batch, const mftp_view *p, const char *name) {
+   // search for file in the cache, then the directory.
+   s->file = file_cache_open(s->files, name, &s->checksum);
+   // if no such file then break out and serv new client.
+   if (s->file == NULL) {
+      send_error(p->seq, s->conn, s->sock, s->client, s->clen);
+      return 0;
+   }
+   DEBUGF("File: %s requested.\n", name);
+   if (s->file->map == NULL) {
+      // with io_uring the file is read through a fixed file slot.
+      s->fileslot = batch_add_file(batch, s->file->fd);
+   }
+   snprintf(s->filename, sizeof(s->filename), "%s", name);
+   return 1;
+}
+
+static void send_inline(session *s, rudp_batch *batch, unsigned int seq) {
+   // the client's other connections only learn the file, chunk 0's
+   // connection brings it.
+   long long size = s->offset == 0 ? s->file->size : 0;
+   DEBUGF("File: %s sent whole, %lld of %lld bytes.\n", s->filename, size, s->file->size);
+   char *reply = batch_buffer(batch);
+   int len = snprintf(reply, MFTP_MAXDATA, "%lld %lld %08x 0 %lld", s->file->size,
+                      (long long)s->file->mtime, s->checksum, size);
+   batch_queue(batch, &s->client, s->clen, ACK, OPT_INLINE, s->conn, seq, 0, reply, len);
+   // the data is copied into the batch, the file may close before the flush.
+   for (long long at = 0; at < size; at += SEGMENT_SIZE) {
+      char *data = batch_buffer(batch);
+      len = read_file_chunk(at, s->file->fd, data, s->file->size);
+      batch_queue(batch, &s->client, s->clen, DATA, OPT_INLINE, s->conn,
+                  (unsigned int)(at / SEGMENT_SIZE), 0, data, len);
+   }
+}
+
+static void plan_chunk(session *s) {
+   // the last chunk also takes the bytes the even split leaves over.
+   long long chunksize = s->file->size / s->cnum;
+   s->start = chunksize * s->offset;
+   s->chunklen = s->offset == s->cnum - 1 ? s->file->size - s->start : chunksize;
+   DEBUGF("Filename: %s. Chunk: %lld bytes at %lld. Offset: %d.\n", s->filename,
+          s->chunklen, s->start, s->offset);
+   unsigned int segments = (unsigned int)((s->chunklen + SEGMENT_SIZE - 1) / SEGMENT_SIZE);
+   // the agreed window size caps the congestion window from here on.
+   cc_init(&s->cc, s->cc.ops, s->window.size);
+   send_window_init(&s->window, cc_window(&s->cc), segments);
+}
+
+static void fill_window(session *s, rudp_batch *batch) {
+   while (send_window_open(&s->window)) {
+       send_segment(s, batch, s->window.next);
+   }
+   s->last_packet = DATA;
+   if (send_window_done(&s->window)) {
+       DEBUGF("Chunk %d fully acknowledged.\n", s->offset);
+       send_done(s->window.total, s->conn, s->sock, s->client, s->clen);
+       s->last_packet = DONE;
+       s->last_packet_seq = s->window.total;
+       s->transferring = 0;
+       s->state = 5;
+   }
+}
+
+static void resend_expired(session *s, rudp_batch *batch, long long now) {
+   int expired = 0;
+   for (unsigned int seq = s->window.base; seq < s->window.next; ++seq) {
+       if (send_window_expired(&s->window, seq, now, s->rtt.rto)) {
+           DEBUGF("Resending segment %u of chunk %d.\n", seq, s->offset);
+           send_segment(s, batch, seq);
+           s->timeout_resends++;
+           expired = 1;
+       }
+   }
+   if (expired) {
+       // back off until an ack brings a fresh sample.
+       rtt_backoff(&s->rtt);
+       cc_loss(&s->cc, TRUE, now);
+       s->window.size = cc_window(&s->cc);
+   }
+}
+
+static int resend_lost(session *s, rudp_batch *batch) {
+   unsigned int lost[MAX_WINDOW];
+   int n = send_window_tally(&s->window, lost);
+   for (int i = 0; i < n; ++i) {
+       DEBUGF("Fast resend of segment %u of chunk %d.\n", lost[i], s->offset);
+       send_segment(s, batch, lost[i]);
+       s->fast_resends++;
+   }
+   return n;
+}
+
+static void send_segment(session *s, rudp_batch *batch, unsigned int seq) {
+    long long f_offset = s->start + (long long)seq*SEGMENT_SIZE;
+    long long end = s->start + s->chunklen;
+    // the client echoes the stamp, which times the round trip.
+    long long now = current_time_usec();
+    unsigned int ts = (unsigned int)now;
+    unsigned char opts = OPT_TS;
+    if (seq < s->window.next) {
+        opts |= OPT_RESENT;
+    }
+    const cached_file *f = s->file;
+    if (f->map != NULL) {
+        // the payload is sent straight out of the mapped pages.
+        int len = chunk_segment_len(f_offset, end);
+        if ((size_t)f_offset + len > f->maplen) {
+            len = f_offset < (long long)f->maplen ? (int)(f->maplen - f_offset) : 0;
+        }
+        send_window_sent(&s->window, seq, now);
+        batch_queue(batch, &s->client, s->clen, DATA, opts, s->conn, seq, ts, f->map + f_offset, len);
+        return;
+    }
+    if (s->chunks != NULL) {
+        // blocks are aligned to the file, not the chunk, so every chunk
+        // split of the file hits the same blocks.
+        long long base = f_offset / CHUNK_BLOCK_SIZE * CHUNK_BLOCK_SIZE;
+        chunk_block *b = chunk_cache_find(s->chunks, f, base);
+        int cached = b != NULL;
+        if (b == NULL) {
+            long long left = f->size - base;
+            int blen = left < CHUNK_BLOCK_SIZE ? (int)left : CHUNK_BLOCK_SIZE;
+            if (chunk_cache_full(s->chunks, blen)) {
+                // queued frames may point into the blocks about to go.
+                batch_drain(batch);
+            }
+            b = chunk_cache_fill(s->chunks, f, base, blen);
+        }
+        int at = (int)(f_offset - base);
+        int len = chunk_segment_len(f_offset, end);
+        if (b != NULL && at + len <= b->len) {
+            if (cached) {
+                s->chunks->hits++;
+            } else {
+                s->chunks->misses++;
+            }
+            send_window_sent(&s->window, seq, now);
+            batch_queue(batch, &s->client, s->clen, DATA, opts, s->conn, seq, ts, b->data + at, len);
+            return;
+        }
+        // the segment runs into the next block, or the file shrank.
+        s->chunks->misses++;
+    }
+    if (batch->ring != NULL) {
+        // the ring reads the payload just before it sends the frame.
+        int len = chunk_segment_len(f_offset, end);
+        send_window_sent(&s->window, seq, now);
+        batch_queue_read(batch, &s->client, s->clen, DATA, opts, s->conn, seq, ts,
+                         f->fd, s->fileslot, f_offset, len);
+        return;
+    }
+    // read the file data straight into the slot it is sent from.
+    char *data = batch_buffer(batch);
+    int len = read_file_chunk(f_offset, f->fd, data, end);
+    send_window_sent(&s->window, seq, now);
+    batch_queue(batch, &s->client, s->clen, DATA, opts, s->conn, seq, ts, data, len);
+}
+
+static void send_reply(session *s) {
+   char reply[64];
+   int len = 0;
+   if (s->state == 2) {
+      // the client sizes its file from this and skips the transfer when
+      // its copy already has the checksum.
+      len = snprintf(reply, sizeof(reply), "%lld %lld %08x", s->file->size,
+                     (long long)s->file->mtime, s->checksum);
+   } else if (s->state == 4) {
+      // the client writes its chunk at this file offset, so it needs no
+      // temp file and no reassembly.
+      len = snprintf(reply, sizeof(reply), "%lld %lld", s->start, s->chunklen);
+   } else {
+      send_ack(s->last_packet_seq, s->conn, s->sock, s->client, s->clen);
+      return;
+   }
+   if (!send_frame(s->sock, &s->client, s->clen, ACK, 0, s->conn, s->last_packet_seq, reply, len)) {
+      fprintf(stderr, "Error: ack sendto() error.\n");
+   }
+}
+
+int session_table_init(session_table *t) {
+    t->count = 0;
+    t->mask = 63;
+    t->buckets = calloc(t->mask + 1, sizeof(session *));
+    return t->buckets != NULL;
+}
+
+session *session_table_find(const session_table *t, unsigned int conn,
+                            const sockaddr_in *from) {
+    session *s = t->buckets[session_hash(conn, from) & t->mask];
+    while (s != NULL) {
+        if (s->conn == conn && s->client.sin_port == from->sin_port
+            && s->client.sin_addr.s_addr == from->sin_addr.s_addr) {
+            return s;
+        }
+        s = s->hnext;
+    }
+    return NULL;
+}
+
+void session_table_insert(session_table *t, session *s) {
+    if (t->count > t->mask) {
+        // double the buckets, keep the old ones if memory is short.
+        unsigned int mask = t->mask * 2 + 1;
+        session **buckets = calloc(mask + 1, sizeof(session *));
+        if (buckets != NULL) {
+            for (unsigned int i = 0; i <= t->mask; ++i) {
+                session *e = t->buckets[i];
+                while (e != NULL) {
+                    session *next = e->hnext;
+                    unsigned int b = session_hash(e->conn, &e->client) & mask;
+                    e->hnext = buckets[b];
+                    buckets[b] = e;
+                    e = next;
+                }
+            }
+            free(t->buckets);
+            t->buckets = buckets;
+            t->mask = mask;
+        }
+    }
+    unsigned int b = session_hash(s->conn, &s->client) & t->mask;
+    s->hnext = t->buckets[b];
+    t->buckets[b] = s;
+    t->count++;
+}
+
+void session_table_remove(session_table *t, session *s) {
+    session **link = &t->buckets[session_hash(s->conn, &s->client) & t->mask];
+    while (*link != NULL) {
+        if (*link == s) {
+            *link = s->hnext;
+            s->hnext = NULL;
+            t->count--;
+            return;
+        }
+        link = &(*link)->hnext;
+    }
+}
+
+void session_table_destroy(session_table *t) {
+    free(t->buckets);
+    t->buckets = NULL;
+    t->count = 0;
+}
+
+static void send_request_reply(session *s, unsigned int seq) {
+   char reply[96];
+   int len = snprintf(reply, sizeof(reply), "%lld %lld %08x %lld %lld", s->file->size,
+                      (long long)s->file->mtime, s->checksum, s->start, s->chunklen);
+   if (!send_frame(s->sock, &s->client, s->clen, ACK, 0, s->conn, seq, reply, len)) {
+      fprintf(stderr, "Error: ack sendto() error.\n");
+   }
+}
+
+static unsigned int session_hash(unsigned int conn, const sockaddr_in *from) {
+    unsigned int h = conn ^ from->sin_addr.s_addr ^ ((unsigned int)from->sin_port << 16);
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h;
+}
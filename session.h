@@ -0,0 +1,208 @@
+// File: session.h
+// Created October 17, 2026
+
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+#include <stdio.h>
+#include "rudp.h"
+#include "filecache.h"
+#include "chunkcache.h"
+#include "congestion.h"
+
+/**
+ * @file session.h
+ * One client connection to the server, driven by a worker's event loop.
+ * The state machine is the one handle_client_request used to run in its
+ * own thread: 1 filename, 2 connection count, 3 chunk index, 4 stream the
+ * chunk, 5 linger until the client has the done packet. The ack of the
+ * filename carries the file's size, mtime and checksum, the ack of the
+ * chunk index the chunk's file offset and length, both as text, so the
+ * client can size the file and write each chunk in place.
+ *
+ * A client may instead open with one REQ packet whose payload is
+ * "cnum index window filename". The session then goes straight to state
+ * 4: it answers with one ack carrying "size mtime checksum offset length"
+ * and sends the first window of data right behind it. A file no bigger
+ * than the session's inline size is sent whole instead: the ack is
+ * marked OPT_INLINE, names the whole file as the range, and every data
+ * packet follows it in the same flush with no window and no session
+ * left behind. A client that misses any of it sends the REQ again. Only
+ * the request for chunk 0 gets the data, the others get an OPT_INLINE
+ * ack with an empty range.
+ *
+ * Every data packet is stamped with OPT_TS and the client echoes the
+ * stamp in its ack, so each new ack is a round trip sample. Segments are
+ * resent after the timeout those samples give, doubled each time it runs
+ * out without a new sample. Since each ack names one segment, an ack
+ * past an outstanding segment shows a hole, and a segment passed by
+ * DUP_THRESH acks of segments sent after it is resent at once.
+ *
+ * The send window holds no more new segments than the connection's
+ * congestion controller allows. New acks, round trip samples and both
+ * kinds of loss are handed to it, and its window is capped at the
+ * window size the server and the client agreed on.
+ *
+ * Sessions share their worker's socket. Every packet carries the
+ * connection id the client picked, and the worker finds the session for
+ * a datagram in a session_table keyed on that id and the sender address.
+ */
+
+/**
+ * Idle time in microseconds before a connection counts a timeout.
+ */
+#define IDLE_TIMEOUT 5000000
+
+/**
+ * Per connection state. Everything handle_client_request kept on its
+ * stack, so a worker can hold thousands of these at once.
+ */
+typedef struct session {
+    int sock;                   // the worker socket, not owned by the session.
+    unsigned int conn;          // connection id picked by the client.
+    sockaddr_in client;         // client address.
+    unsigned int clen;          // length of client.
+    char state;                 // state machine position, 1 - 5.
+    int last_packet;            // flag of the last control packet sent.
+    int last_packet_seq;        // sequence number it was sent with.
+    file_cache *files;          // the server's open files, shared.
+    cached_file *file;          // the requested file once state 1 passes.
+    uint32_t checksum;          // its checksum when it was opened, 0 if not known yet.
+    chunk_cache *chunks;        // the worker's cached file blocks, or NULL.
+    int fileslot;               // fixed file slot of file on the ring, or -1.
+    char filename[256];         // name of the requested file.
+    int cnum;                   // chunks the client splits the file into.
+    int offset;                 // which chunk this connection serves.
+    long long start;            // file offset of the chunk.
+    long long chunklen;         // bytes in the chunk, the last one takes the remainder.
+    int connection_timeouts;    // idle periods in a row.
+    int transferring;           // set once the client sends START in state 4.
+    int requested;              // opened with a REQ packet.
+    long long inline_size;      // files up to this size go whole in the reply to a REQ.
+    long long last_heard;       // time of the last packet or idle timeout.
+    send_window window;         // data segments in flight.
+    rtt_estimator rtt;          // round trip time from the timestamps acks echo.
+    cc_state cc;                // congestion window, sizes the send window.
+    unsigned long fast_resends; // segments resent because later ones were acked.
+    unsigned long timeout_resends; // segments resent because their timeout ran out.
+    long long deadline;         // when session_on_timer must next run.
+    int heapidx;                // position in the owning worker's timer heap.
+    struct session *hnext;      // next session in the same table bucket.
+} session;
+
+/**
+ * Hash table of sessions keyed on connection id and client address.
+ */
+typedef struct session_table {
+    session **buckets;          // chains linked through session.hnext.
+    unsigned int mask;          // bucket count - 1, a power of two.
+    unsigned int count;         // sessions in the table.
+} session_table;
+
+/**
+ * Starts a session for a client that opened a connection. The opening
+ * packet is then handed to session_on_packet.
+ *
+ * @param sock The worker socket the client talks to.
+ * @param client The client address.
+ * @param conn The connection id from the opening packet.
+ * @param window The send window size for the connection.
+ * @param files The cache the requested file is opened through.
+ * @param chunks The worker's block cache to send from, or NULL.
+ * @param inline_size Largest file sent whole in the reply to a REQ.
+ * @param cc The congestion controller for the connection.
+ *
+ * @return The new session, or NULL if it could not be allocated.
+ */
+session *session_create(int sock, const sockaddr_in *client, unsigned int conn,
+                        unsigned int window, file_cache *files, chunk_cache *chunks,
+                        long long inline_size, const cc_ops *cc);
+
+/**
+ * Handles one packet of the session. Replies are queued on the batch and
+ * go out with the worker's next flush. A DONE from the client ends the
+ * session, it sends one when its copy of the file is already current.
+ * So does a REQ for a small file, which is answered whole.
+ *
+ * @param s The session.
+ * @param batch The worker's batch.
+ * @param p The packet.
+ *
+ * @return 1 while the session is alive, 0 once it should be destroyed.
+ */
+int session_on_packet(session *s, rudp_batch *batch, const mftp_view *p);
+
+/**
+ * Runs the session's timers: resends overdue segments and counts idle
+ * periods. Call when the deadline has passed.
+ *
+ * @param s The session.
+ * @param batch The worker's batch.
+ * @param now The current time in microseconds.
+ *
+ * @return 1 while the session is alive, 0 once it should be destroyed.
+ */
+int session_on_timer(session *s, rudp_batch *batch, long long now);
+
+/**
+ * Recomputes s->deadline from the idle timer and the send window.
+ *
+ * @param s The session.
+ *
+ * @return The new deadline in microseconds.
+ */
+long long session_update_deadline(session *s);
+
+/**
+ * Closes the session's file and frees the session.
+ *
+ * @param s The session.
+ * @param batch The worker's batch, which gives back the file's ring slot.
+ */
+void session_destroy(session *s, rudp_batch *batch);
+
+/**
+ * Sets up an empty session table.
+ *
+ * @param t The table.
+ *
+ * @return 1 on success, 0 if the buckets could not be allocated.
+ */
+int session_table_init(session_table *t);
+
+/**
+ * Looks up the session a datagram belongs to.
+ *
+ * @param t The table.
+ * @param conn The connection id from the packet header.
+ * @param from The sender address.
+ *
+ * @return The session, or NULL if there is none.
+ */
+session *session_table_find(const session_table *t, unsigned int conn,
+                            const sockaddr_in *from);
+
+/**
+ * Adds a session, growing the table when it gets full.
+ *
+ * @param t The table.
+ * @param s The session.
+ */
+void session_table_insert(session_table *t, session *s);
+
+/**
+ * Removes a session from the table. Does not destroy it.
+ *
+ * @param t The table.
+ * @param s The session.
+ */
+void session_table_remove(session_table *t, session *s);
+
+/**
+ * Frees the buckets. Sessions still in the table are not destroyed.
+ *
+ * @param t The table.
+ */
+void session_table_destroy(session_table *t);
+
+#endif
@@ -0,0 +1,170 @@
+// File: syscount.c
+// Created October 17, 2026
+
+/*******
+NAME
+     syscount -- counts the system calls made by a command
+
+SYNOPSIS
+     syscount command [args ...]
+
+DESCRIPTION
+     Runs command under ptrace(2), following every thread and child it
+     creates, and prints the number of system calls each one made to
+     stderr when the command exits. SIGINT and SIGTERM are passed on to
+     the command. Used by bench.sh to compare the server I/O engines;
+     system calls answered by the vDSO, such as gettimeofday, are not
+     seen and not counted.
+
+EXIT STATUS
+     The exit status of command, or 1 if it could not be traced.
+******/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <linux/ptrace.h>
+
+#define MAX_SYSCALL 1024
+
+static pid_t child = 0;
+static unsigned long counts[MAX_SYSCALL];
+
+// names of the calls the server and client make, for the report.
+static const struct { long nr; const char *name; } names[] = {
+    { SYS_read, "read" }, { SYS_write, "write" }, { SYS_pread64, "pread64" },
+    { SYS_pwrite64, "pwrite64" }, { SYS_pwritev, "pwritev" }, { SYS_fallocate, "fallocate" },
+    { SYS_lseek, "lseek" }, { SYS_openat, "openat" }, { SYS_close, "close" },
+    { SYS_sendto, "sendto" }, { SYS_recvfrom, "recvfrom" },
+    { SYS_sendmsg, "sendmsg" }, { SYS_recvmsg, "recvmsg" },
+    { SYS_sendmmsg, "sendmmsg" }, { SYS_recvmmsg, "recvmmsg" },
+    { SYS_epoll_ctl, "epoll_ctl" }, { SYS_epoll_pwait, "epoll_pwait" },
+#ifdef SYS_epoll_wait
+    { SYS_epoll_wait, "epoll_wait" },
+#endif
+#ifdef SYS_poll
+    { SYS_poll, "poll" },
+#endif
+#ifdef SYS_select
+    { SYS_select, "select" },
+#endif
+    { SYS_ppoll, "ppoll" }, { SYS_pselect6, "pselect6" },
+    { SYS_io_uring_setup, "io_uring_setup" }, { SYS_io_uring_enter, "io_uring_enter" },
+    { SYS_io_uring_register, "io_uring_register" },
+    { SYS_futex, "futex" }, { SYS_mmap, "mmap" }, { SYS_munmap, "munmap" },
+    { SYS_mprotect, "mprotect" }, { SYS_madvise, "madvise" }, { SYS_brk, "brk" },
+    { SYS_fstat, "fstat" }, { SYS_newfstatat, "newfstatat" }, { SYS_getdents64, "getdents64" },
+    { SYS_clone, "clone" }, { SYS_clone3, "clone3" }, { SYS_rt_sigprocmask, "rt_sigprocmask" },
+    { SYS_rt_sigtimedwait, "rt_sigtimedwait" }, { SYS_getrandom, "getrandom" },
+    { SYS_socket, "socket" }, { SYS_bind, "bind" }, { SYS_setsockopt, "setsockopt" },
+    { SYS_clock_nanosleep, "clock_nanosleep" }, { SYS_pipe2, "pipe2" },
+    { SYS_execve, "execve" }, { SYS_ioctl, "ioctl" }, { SYS_rt_sigaction, "rt_sigaction" },
+    { SYS_exit, "exit" }, { SYS_exit_group, "exit_group" }, { SYS_getrusage, "getrusage" },
+    { SYS_sched_getaffinity, "sched_getaffinity" }, { SYS_epoll_create1, "epoll_create1" },
+};
+
+static const char *syscall_name(long nr) {
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (names[i].nr == nr) return names[i].name;
+    }
+    return NULL;
+}
+
+static void forward_signal(int sig) {
+    if (child > 0) kill(child, sig);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s command [args ...]\n", argv[0]);
+        return 1;
+    }
+    child = fork();
+    if (child < 0) {
+        perror("Error: fork() failed ");
+        return 1;
+    }
+    if (child == 0) {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        execvp(argv[1], argv + 1);
+        perror("Error: execvp() failed ");
+        _exit(127);
+    }
+
+    int status = 0;
+    if (waitpid(child, &status, 0) < 0 || !WIFSTOPPED(status)) {
+        fprintf(stderr, "Error: could not trace %s.\n", argv[1]);
+        return 1;
+    }
+    long opts = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK
+              | PTRACE_O_TRACEVFORK | PTRACE_O_EXITKILL;
+    ptrace(PTRACE_SETOPTIONS, child, NULL, (void *)opts);
+    ptrace(PTRACE_SYSCALL, child, NULL, NULL);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = forward_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int exit_code = 1;
+    for (;;) {
+        pid_t pid = waitpid(-1, &status, __WALL);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break; // ECHILD, everything traced has exited.
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (pid == child) {
+                exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            }
+            continue;
+        }
+        if (!WIFSTOPPED(status)) continue;
+        int sig = WSTOPSIG(status);
+        int inject = 0;
+        if (sig == (SIGTRAP | 0x80)) {
+            struct ptrace_syscall_info info;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, (void *)sizeof(info), &info) > 0
+                && info.op == PTRACE_SYSCALL_INFO_ENTRY && info.entry.nr < MAX_SYSCALL) {
+                counts[info.entry.nr]++;
+            }
+        } else if (sig == SIGTRAP || sig == SIGSTOP) {
+            // clone, fork and exec events and the first stop of new threads.
+        } else {
+            inject = sig;
+        }
+        ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)inject);
+    }
+
+    unsigned long total = 0;
+    for (int nr = 0; nr < MAX_SYSCALL; ++nr) {
+        total += counts[nr];
+    }
+    fprintf(stderr, "syscount: %lu system calls\n", total);
+    for (;;) {
+        // largest first.
+        int best = -1;
+        for (int nr = 0; nr < MAX_SYSCALL; ++nr) {
+            if (counts[nr] > 0 && (best < 0 || counts[nr] > counts[best])) best = nr;
+        }
+        if (best < 0) break;
+        const char *name = syscall_name(best);
+        if (name != NULL) {
+            fprintf(stderr, "syscount: %10lu %s\n", counts[best], name);
+        } else {
+            fprintf(stderr, "syscount: %10lu syscall %d\n", counts[best], best);
+        }
+        counts[best] = 0;
+    }
+    return exit_code;
+}
@@ -0,0 +1,189 @@
+// File: uring.c
+// Created October 17, 2026
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// comment this out to turn on debug prints.
+//#define NDEBUG NDEBUG
+
+#include "uring.h"
+#include "utils.h"
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(uring *r, unsigned entries) {
+    memset(r, 0, sizeof(*r));
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // completions are only needed when the worker asks for them.
+    p.flags = IORING_SETUP_COOP_TASKRUN;
+    r->fd = sys_io_uring_setup(entries, &p);
+    if (r->fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        r->fd = sys_io_uring_setup(entries, &p);
+    }
+    if (r->fd < 0) {
+        return 0;
+    }
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        // waits need a timeout, which io_uring_enter only takes since 5.11.
+        close(r->fd);
+        errno = ENOSYS;
+        return 0;
+    }
+    r->entries = p.sq_entries;
+
+    r->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_len > r->sq_ring_len) r->sq_ring_len = r->cq_ring_len;
+        r->cq_ring_len = r->sq_ring_len;
+    }
+    r->sq_ring = mmap(NULL, r->sq_ring_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        close(r->fd);
+        return 0;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) {
+            munmap(r->sq_ring, r->sq_ring_len);
+            close(r->fd);
+            return 0;
+        }
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        if (r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_ring_len);
+        munmap(r->sq_ring, r->sq_ring_len);
+        close(r->fd);
+        return 0;
+    }
+
+    char *sq = r->sq_ring;
+    char *cq = r->cq_ring;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    DEBUGF("io_uring ready: %u sq entries, %u cq entries.\n", p.sq_entries, p.cq_entries);
+    return 1;
+}
+
+void uring_destroy(uring *r) {
+    if (r->fd < 0) return;
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_ring_len);
+    munmap(r->sq_ring, r->sq_ring_len);
+    close(r->fd);
+    r->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *r->sq_tail;
+    if (tail - head >= r->entries) {
+        if (uring_submit(r, 0, -1) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= r->entries) {
+            return NULL;
+        }
+    }
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->queued++;
+    return sqe;
+}
+
+int uring_submit(uring *r, unsigned wait_nr, long long timeout_usec) {
+    unsigned flags = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    void *argp = NULL;
+    size_t argsz = 0;
+    if (wait_nr > 0) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        memset(&arg, 0, sizeof(arg));
+        if (timeout_usec >= 0) {
+            ts.tv_sec = timeout_usec / 1000000;
+            ts.tv_nsec = (timeout_usec % 1000000) * 1000;
+            arg.ts = (unsigned long long)(unsigned long)&ts;
+        }
+        argp = &arg;
+        argsz = sizeof(arg);
+    } else if (r->queued == 0) {
+        return 0;
+    }
+    unsigned submit = r->queued;
+    int n = sys_io_uring_enter(r->fd, submit, wait_nr, flags, argp, argsz);
+    r->enter_calls++;
+    if (n < 0) {
+        if (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+            return 0;
+        }
+        return -1;
+    }
+    r->queued -= (unsigned)n <= r->queued ? (unsigned)n : r->queued;
+    r->sqes_submitted += n;
+    return n;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring *r) {
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &r->cqes[head & *r->cq_mask];
+}
+
+void uring_cqe_seen(uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_register_files(uring *r, const int *fds, unsigned n) {
+    return sys_io_uring_register(r->fd, IORING_REGISTER_FILES, fds, n) == 0;
+}
+
+int uring_update_file(uring *r, unsigned slot, int fd) {
+    struct io_uring_files_update up;
+    memset(&up, 0, sizeof(up));
+    up.offset = slot;
+    up.fds = (unsigned long long)(unsigned long)&fd;
+    return sys_io_uring_register(r->fd, IORING_REGISTER_FILES_UPDATE, &up, 1) == 1;
+}
+
+int uring_register_buffers(uring *r, const struct iovec *iovs, unsigned n) {
+    return sys_io_uring_register(r->fd, IORING_REGISTER_BUFFERS, iovs, n) == 0;
+}
@@ -0,0 +1,129 @@
+// File: uring.h
+// Created October 17, 2026
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/**
+ * @file uring.h
+ * Minimal io_uring wrapper on the raw system calls, no liburing needed.
+ * Only what the datagram batch uses: one ring, submit and wait in one
+ * io_uring_enter(2), fixed files and fixed buffers.
+ */
+
+/**
+ * A submission and completion ring pair mapped into the process.
+ */
+typedef struct uring {
+    int fd;                         // ring file descriptor.
+    unsigned entries;               // submission queue size.
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;                  // mappings, kept for munmap.
+    size_t sq_ring_len;
+    void *cq_ring;
+    size_t cq_ring_len;
+    size_t sqes_len;
+    unsigned queued;                // sqes filled in but not yet submitted.
+    unsigned long enter_calls;      // io_uring_enter(2) calls made.
+    unsigned long sqes_submitted;   // sqes handed to the kernel.
+} uring;
+
+/**
+ * Creates a ring and maps its queues.
+ *
+ * @param r The ring to set up.
+ * @param entries Submission queue size, a power of two.
+ *
+ * @return 1 on success, 0 with errno set if io_uring is unavailable.
+ */
+int uring_init(uring *r, unsigned entries);
+
+/**
+ * Unmaps the queues and closes the ring.
+ *
+ * @param r The ring.
+ */
+void uring_destroy(uring *r);
+
+/**
+ * Hands out the next free submission entry, zeroed. Submits what is
+ * queued first if the submission queue is full.
+ *
+ * @param r The ring.
+ *
+ * @return The entry, or NULL if the queue could not be drained.
+ */
+struct io_uring_sqe *uring_get_sqe(uring *r);
+
+/**
+ * Submits the queued entries and waits for completions in one call.
+ *
+ * @param r The ring.
+ * @param wait_nr Completions to wait for, 0 to only submit.
+ * @param timeout_usec Longest wait in microseconds, -1 for no limit.
+ *
+ * @return Entries submitted, 0 on timeout or signal, -1 on error.
+ */
+int uring_submit(uring *r, unsigned wait_nr, long long timeout_usec);
+
+/**
+ * Returns the oldest unseen completion without waiting.
+ *
+ * @param r The ring.
+ *
+ * @return The completion, or NULL if there is none.
+ */
+struct io_uring_cqe *uring_peek_cqe(uring *r);
+
+/**
+ * Marks the completion returned by uring_peek_cqe as consumed.
+ *
+ * @param r The ring.
+ */
+void uring_cqe_seen(uring *r);
+
+/**
+ * Registers the fixed file table. Slots holding -1 are left empty.
+ *
+ * @param r The ring.
+ * @param fds The descriptors.
+ * @param n Number of slots.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int uring_register_files(uring *r, const int *fds, unsigned n);
+
+/**
+ * Replaces one slot of the fixed file table.
+ *
+ * @param r The ring.
+ * @param slot The slot.
+ * @param fd The descriptor, or -1 to empty the slot.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int uring_update_file(uring *r, unsigned slot, int fd);
+
+/**
+ * Registers fixed buffers for the *_FIXED read and write opcodes.
+ *
+ * @param r The ring.
+ * @param iovs The buffers.
+ * @param n Number of buffers.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int uring_register_buffers(uring *r, const struct iovec *iovs, unsigned n);
+
+#endif
@@ -10,6 +10,7 @@
 #include <stdarg.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 // comment this out to turn on debug prints.
 //#define NDEBUG NDEBUG
@@ -66,45 +67,164 @@ int get_file_size(FILE *restrict file) {
    return size;
 }
 
-mftp_packet get_file_chunk(int f_offset, FILE *restrict stream, int seq, int chunksize, int cnum) {
-    char buffer[1024]; // buffer to hold file chunk
-    bzero(buffer, sizeof(buffer));
-    int ls = lseek(fileno(stream), f_offset, SEEK_SET);
-    if (ls == -1) {
-       fprintf(stderr, "Error: seeking to requested chunk location failed. File buffer pointer at unknown location.\n");
+int chunk_segment_len(long long f_offset, long long end) {
+    long long left = end - f_offset;
+    if (left > SEGMENT_SIZE) {
+        return SEGMENT_SIZE;
     }
-    int bytes_to_read = 0;
-    if (chunksize*(cnum + 1) - f_offset > 1023) {
-        bytes_to_read = 1023;
-    } else {
-        bytes_to_read = chunksize*(cnum + 1) - f_offset;
-    }
-    DEBUGF("CHUNK %d OFFSET %d BYTES TO READ: %d\n", chunksize*(cnum + 1), f_offset, bytes_to_read);
+    return left > 0 ? (int)left : 0;
+}
+
+int read_file_chunk(long long f_offset, int fd, char *buffer, long long end) {
+    // pread leaves the file position alone, so sessions can share the file.
+    int bytes_to_read = chunk_segment_len(f_offset, end);
     int numbytes = 0;
-    while (numbytes != bytes_to_read) {
-       int x = read(fileno(stream), buffer, bytes_to_read);
-       if (x == 0 || x < -1) {
+    while (numbytes < bytes_to_read) {
+       int x = pread(fd, buffer + numbytes, bytes_to_read - numbytes, f_offset + numbytes);
+       if (x == 0 || x < 0) {
           fprintf(stderr, "Warning: reading from file into send buffer either finished or failed. Number of bytes read: %d\n", numbytes);
           break;
        }
        numbytes += x;
     }
+    return numbytes;
+}
 
-    ls = lseek(fileno(stream), 0, SEEK_SET);
-    if (ls == -1) {
-       fprintf(stderr, "Error: seeking to requested chunk location failed. File buffer pointer at unknown location.\n");
+const char *map_file(int fd, size_t *len) {
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        return NULL;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Warning: mmap() of file failed: %s.\n", strerror(errno));
+        return NULL;
     }
+    // segments are sent in file order.
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    *len = (size_t)st.st_size;
+    return map;
+}
 
-    mftp_packet p;
-    p.seq = seq;
-    p.flag = DATA;
-    bzero(p.data, 1024);
-    memcpy(p.data, buffer, sizeof(buffer));
-    if (f_offset == 0) 
-    DEBUGF("%s", p.data);
-    return p;
+char *map_file_range(int fd, long long offset, long long len, char **data, size_t *maplen) {
+    long long skew = offset % sysconf(_SC_PAGESIZE);
+    void *map = mmap(NULL, (size_t)(len + skew), PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset - skew);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: mmap() of file range failed: %s.\n", strerror(errno));
+        return NULL;
+    }
+    *data = (char *)map + skew;
+    *maplen = (size_t)(len + skew);
+    return map;
 }
 
+void unmap_file(const char *map, size_t len) {
+    if (map != NULL) {
+        munmap((void *)map, len);
+    }
+}
+
+uint32_t file_checksum(int fd, long long size) {
+    char *buf = malloc(1 << 20);
+    if (buf == NULL) {
+        fprintf(stderr, "Error: malloc() of checksum buffer failed.\n");
+        return 0;
+    }
+    uint32_t h = 2166136261u;
+    long long done = 0;
+    while (done < size) {
+        int want = size - done < (1 << 20) ? (int)(size - done) : (1 << 20);
+        ssize_t x = pread(fd, buf, want, done);
+        if (x <= 0) {
+            if (x < 0 && errno == EINTR) continue;
+            fprintf(stderr, "Warning: checksum read stopped at %lld of %lld bytes.\n", done, size);
+            free(buf);
+            return 0;
+        }
+        for (ssize_t i = 0; i < x; ++i) {
+            h ^= (unsigned char)buf[i];
+            h *= 16777619u;
+        }
+        done += x;
+    }
+    free(buf);
+    // 0 stands for no checksum in the catalog.
+    return h != 0 ? h : 1;
+}
+
+// writes all of data at offset, counting the calls.
+static int write_at(write_behind *w, const char *data, int len, long long offset) {
+   int done = 0;
+   while (done < len) {
+      ssize_t x = pwrite(w->fd, data + done, len - done, offset + done);
+      w->writes++;
+      if (x < 0) {
+         if (errno == EINTR) continue;
+         fprintf(stderr, "Error: pwrite() failed: %s.\n", strerror(errno));
+         return 0;
+      }
+      done += (int)x;
+   }
+   return 1;
+}
+
+int write_behind_init(write_behind *w, int fd, int size) {
+   memset(w, 0, sizeof(*w));
+   w->fd = fd;
+   if (size <= 0) {
+      return 1;
+   }
+   // page aligned, so the blocks could also go out with O_DIRECT.
+   void *buf = NULL;
+   if (posix_memalign(&buf, 4096, size) != 0) {
+      fprintf(stderr, "Error: posix_memalign() of write-behind buffer failed.\n");
+      return 0;
+   }
+   w->buf = buf;
+   w->size = size;
+   return 1;
+}
+
+int write_behind_add(write_behind *w, long long offset, const char *data, int len) {
+   if (w->buf == NULL) {
+      // write through, one call per payload.
+      return write_at(w, data, len, offset);
+   }
+   if (w->used > 0 && offset != w->offset + w->used) {
+      if (!write_behind_flush(w)) return 0;
+   }
+   if (w->used == 0) {
+      w->offset = offset;
+   }
+   while (len > 0) {
+      // end the block on the next multiple of size in the file.
+      int limit = w->size - (int)(w->offset % w->size);
+      int n = limit - w->used < len ? limit - w->used : len;
+      memcpy(w->buf + w->used, data, n);
+      w->used += n;
+      data += n;
+      len -= n;
+      if (w->used == limit && !write_behind_flush(w)) {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+int write_behind_flush(write_behind *w) {
+   if (!write_at(w, w->buf, w->used, w->offset)) {
+      return 0;
+   }
+   w->offset += w->used;
+   w->used = 0;
+   return 1;
+}
+
+void write_behind_free(write_behind *w) {
+   free(w->buf);
+   w->buf = NULL;
+   w->used = 0;
+}
 
 void debugprintf(char *format, ...) {
    va_list args;
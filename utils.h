@@ -5,6 +5,7 @@
 #ifndef __UTILS_H__
 #define __UTILS_H__
 
+#include <stdint.h>
 #include "rudp.h"
 
 //#define NDEBUG NoDebug
@@ -54,16 +55,134 @@ FILE *retrieve_file(const char *restrict filename, const char *restrict mode);
 int get_file_size(FILE *restrict filename);
 
 /**
- * Gets a chunk of a file to a client socket.
+ * Number of bytes in the packet of a chunk that starts at f_offset.
+ *
+ * @param f_offset The offset of the packet in the file.
+ * @param end The file offset the chunk ends at.
+ *
+ * @return At most SEGMENT_SIZE, 0 if f_offset is past the chunk.
+ */
+int chunk_segment_len(long long f_offset, long long end);
+
+/**
+ * Reads the next packet worth of a chunk into a caller supplied buffer
+ * with pread(2), so the file position is never moved.
  *
  * @param f_offset The offset to index into the file.
- * @param stream The file to read from to send the chunk.
- * @param seq The sequence number.
- * @param chunksize The chunksize of that the thread is serving.
- * @param cnum The connection number of the n connections (0 - n-1).
+ * @param fd The file to read from.
+ * @param buffer Where to put the data, at least SEGMENT_SIZE bytes.
+ * @param end The file offset the chunk ends at.
+ *
+ * @return The number of bytes read.
+ */
+int read_file_chunk(long long f_offset, int fd, char *buffer, long long end);
+
+/**
+ * Maps a whole file read-only and shared, so packets can be sent straight
+ * out of the page cache. The file must not shrink while it is mapped.
+ *
+ * @param fd The file to map.
+ * @param len Set to the length of the mapping.
+ *
+ * @return The mapping, or NULL if the file is empty or mmap fails.
+ */
+const char *map_file(int fd, size_t *len);
+
+/**
+ * Maps part of a file writable and shared, so data copied into it lands
+ * in the page cache with no write call. The range must lie within the
+ * file; the mapping starts on the page holding offset.
+ *
+ * @param fd The file to map, open for reading and writing.
+ * @param offset File offset of the range.
+ * @param len Length of the range, more than 0.
+ * @param data Set to point at the byte at offset.
+ * @param maplen Set to the length of the mapping.
+ *
+ * @return The mapping for unmap_file, or NULL if mmap fails.
+ */
+char *map_file_range(int fd, long long offset, long long len, char **data, size_t *maplen);
+
+/**
+ * Unmaps a file mapped by map_file or map_file_range.
+ *
+ * @param map The mapping, may be NULL.
+ * @param len Its length.
+ */
+void unmap_file(const char *map, size_t len);
+
+/**
+ * FNV-1a hash of the first size bytes of a file, read with pread(2). The
+ * server announces it in the handshake and the client compares it with
+ * its local copy.
+ *
+ * @param fd The file.
+ * @param size Bytes to hash.
+ *
+ * @return The hash, never 0, or 0 if the file could not be read.
+ */
+uint32_t file_checksum(int fd, long long size);
+
+/**
+ * Default size in bytes of a client's write-behind buffer.
+ */
+#define WRITE_BEHIND_SIZE (1024 * 1024)
+
+/**
+ * Write-behind buffer for one receiver. Contiguous payloads are gathered
+ * and written with one pwrite(2) per block; blocks end on multiples of
+ * the buffer size in the file, so after the first one every write is a
+ * full, aligned block.
+ */
+typedef struct write_behind {
+    int fd;                         // file the data goes to.
+    char *buf;                      // gathered data, NULL to write through.
+    int size;                       // bytes gathered before a flush.
+    int used;                       // bytes in buf.
+    long long offset;               // file offset of buf[0].
+    unsigned long writes;           // pwrite(2) calls made.
+} write_behind;
+
+/**
+ * Sets up a buffer for a file.
+ *
+ * @param w The buffer.
+ * @param fd The file written to.
+ * @param size Bytes gathered before each write, 0 writes every payload
+ *             as it comes.
+ *
+ * @return 1 on success, 0 if memory is short.
+ */
+int write_behind_init(write_behind *w, int fd, int size);
+
+/**
+ * Adds data bound for a file offset. Data that does not follow what is
+ * gathered flushes it first, a full block is written at once.
+ *
+ * @param w The buffer.
+ * @param offset File offset of data.
+ * @param data The bytes.
+ * @param len The length of data.
+ *
+ * @return 1 on success, 0 if a write failed.
+ */
+int write_behind_add(write_behind *w, long long offset, const char *data, int len);
+
+/**
+ * Writes out whatever is gathered.
+ *
+ * @param w The buffer.
+ *
+ * @return 1 on success, 0 if the write failed.
+ */
+int write_behind_flush(write_behind *w);
+
+/**
+ * Frees the buffer, dropping anything not flushed.
  *
+ * @param w The buffer.
  */
-mftp_packet get_file_chunk(int f_offset, FILE *restrict stream, int seq, int chinksize, int cnum);
+void write_behind_free(write_behind *w);
 
 /**
  * Allows for debugging print statements to be made and easily turned off for release build
@@ -0,0 +1,202 @@
+// File: windowtests.c
+// Created October 17, 2026
+
+/*******
+NAME
+     windowtests -- checks the send window and the client's ack policy
+
+SYNOPSIS
+     windowtests
+
+DESCRIPTION
+     Drives send_window and ack_policy through fixed sequences of sends,
+     acks and clock readings, with no sockets and no timers, and prints
+     one line per check. Covers the cases loopback runs rarely hit:
+     acks that arrive out of order below the highest ack, a resent
+     segment acked ahead of older ones, a SACK whose cumulative point
+     is below the window base, and both ack triggers.
+
+EXIT STATUS
+     0 if every check passed, 1 otherwise.
+******/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "rudp.h"
+#include "utils.h"
+
+static int failures = 0;
+
+// prints the result of one check and counts it if it failed.
+static void check(int ok, const char *what);
+
+// sends segments from through to - 1 for the first time, at time 0.
+static void send_range(send_window *w, unsigned int from, unsigned int to);
+
+// sets the SACK bit for seq in map, relative to cum.
+static void sack_bit(char *map, unsigned int cum, unsigned int seq);
+
+// acks arriving out of order, and segments above the highest ack.
+static void test_reordered_acks(void);
+
+// a resent segment is only passed by acks of segments sent after it.
+static void test_resent_segment(void);
+
+// a late SACK with a cumulative point the window already passed.
+static void test_stale_sack(void);
+
+// an ack goes out after N packets, after T usec, or at once for a gap.
+static void test_ack_policy(void);
+
+int main(void) {
+    test_reordered_acks();
+    test_resent_segment();
+    test_stale_sack();
+    test_ack_policy();
+    if (failures > 0) {
+        printf("%d checks failed.\n", failures);
+        return 1;
+    }
+    printf("All checks passed.\n");
+    return 0;
+}
+
+static void check(int ok, const char *what) {
+    printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok) {
+        failures++;
+    }
+}
+
+static void send_range(send_window *w, unsigned int from, unsigned int to) {
+    for (unsigned int seq = from; seq < to; ++seq) {
+        send_window_sent(w, seq, 0);
+    }
+}
+
+static void sack_bit(char *map, unsigned int cum, unsigned int seq) {
+    unsigned int i = seq - cum - 1;
+    map[i / 8] |= 1 << (i % 8);
+}
+
+static void test_reordered_acks(void) {
+    send_window w;
+    unsigned int lost[MAX_WINDOW];
+    send_window_init(&w, 16, 16);
+    send_range(&w, 0, 8);
+
+    // 5, 3 and 4 arrive in that order, one ack each.
+    send_window_ack(&w, 5);
+    check(send_window_tally(&w, lost) == 0, "one later ack loses nothing");
+    send_window_ack(&w, 3);
+    check(send_window_tally(&w, lost) == 0, "an ack below the highest one still counts");
+    send_window_ack(&w, 4);
+    int n = send_window_tally(&w, lost);
+    check(n == 3 && lost[0] == 0 && lost[1] == 1 && lost[2] == 2,
+          "three later acks lose the segments below all of them");
+    check(send_window_tally(&w, lost) == 0, "a tally without new acks finds nothing");
+
+    // 6 and 7 went out after everything acked but were never passed.
+    send_window_ack(&w, 0);
+    send_window_ack(&w, 1);
+    send_window_ack(&w, 2);
+    check(send_window_tally(&w, lost) == 0 && w.base == 6,
+          "segments above the highest ack are not lost");
+
+    // three acks in one SACK count as much as three acks apart.
+    send_window_init(&w, 16, 16);
+    send_range(&w, 0, 6);
+    char map[SACK_BYTES];
+    bzero(map, sizeof(map));
+    sack_bit(map, 1, 3);
+    sack_bit(map, 1, 4);
+    sack_bit(map, 1, 5);
+    check(send_window_sack(&w, 1, map, sizeof(map)) == 4, "a SACK acks below cum and its bits");
+    n = send_window_tally(&w, lost);
+    check(n == 2 && lost[0] == 1 && lost[1] == 2, "one SACK with three later bits loses the holes");
+}
+
+static void test_resent_segment(void) {
+    send_window w;
+    unsigned int lost[MAX_WINDOW];
+    send_window_init(&w, 16, 16);
+    send_range(&w, 0, 5);
+
+    send_window_ack(&w, 1);
+    send_window_tally(&w, lost);
+    send_window_ack(&w, 2);
+    send_window_tally(&w, lost);
+    send_window_ack(&w, 3);
+    int n = send_window_tally(&w, lost);
+    check(n == 1 && lost[0] == 0, "segment 0 is lost after three later acks");
+
+    // resent, 0 now went out after 4, so 4's ack does not pass it.
+    send_window_sent(&w, 0, 10);
+    send_window_ack(&w, 4);
+    check(send_window_tally(&w, lost) == 0, "an ack of a segment sent before the resend is ignored");
+    check(w.next == 5, "a resend is not a new segment");
+
+    // the resent segment acked above the unacked new ones.
+    send_range(&w, 5, 9);
+    send_window_ack(&w, 0);
+    check(send_window_tally(&w, lost) == 0 && w.base == 5,
+          "acking the resend slides the window and passes nothing sent after it");
+
+    send_window_ack(&w, 6);
+    send_window_tally(&w, lost);
+    send_window_ack(&w, 7);
+    send_window_tally(&w, lost);
+    send_window_ack(&w, 8);
+    n = send_window_tally(&w, lost);
+    check(n == 1 && lost[0] == 5, "only the hole below the later acks is lost");
+}
+
+static void test_stale_sack(void) {
+    send_window w;
+    send_window_init(&w, 16, 16);
+    send_range(&w, 0, 10);
+    char map[SACK_BYTES];
+    bzero(map, sizeof(map));
+    check(send_window_sack(&w, 5, map, sizeof(map)) == 5 && w.base == 5, "cum acks everything below it");
+
+    // an older SACK, reordered behind the one above.
+    sack_bit(map, 3, 4);
+    sack_bit(map, 3, 7);
+    sack_bit(map, 3, 8);
+    check(send_window_sack(&w, 3, map, sizeof(map)) == 2, "bits below base are skipped");
+    check(w.base == 5 && w.acked[7 % MAX_WINDOW] && w.acked[8 % MAX_WINDOW]
+          && !w.acked[5 % MAX_WINDOW] && !w.acked[6 % MAX_WINDOW],
+          "bits above base are acked and base stays");
+    check(send_window_sack(&w, 3, map, sizeof(map)) == 0, "the same SACK again acks nothing");
+
+    bzero(map, sizeof(map));
+    check(send_window_sack(&w, 40, map, sizeof(map)) == 3 && w.base == 10,
+          "cum past the last segment sent stops at it");
+}
+
+static void test_ack_policy(void) {
+    ack_policy a;
+    ack_policy_init(&a, 4, 1000);
+    check(ack_policy_timeout(&a, 0) == -1, "no ack is held before data");
+
+    int due = 0;
+    for (int i = 0; i < 3; ++i) {
+        due |= ack_policy_data(&a, i * 10, FALSE);
+    }
+    check(!due, "three packets wait for the fourth");
+    check(ack_policy_data(&a, 30, FALSE), "the fourth packet sends the ack");
+    ack_policy_sent(&a);
+    check(ack_policy_timeout(&a, 30) == -1, "nothing is held after the ack");
+
+    check(!ack_policy_data(&a, 100, FALSE), "one packet waits");
+    check(ack_policy_timeout(&a, 100) == 1000, "the delay runs from the first packet held");
+    check(ack_policy_timeout(&a, 600) == 500, "the timer counts down");
+    check(ack_policy_timeout(&a, 2000) == 0, "an overdue ack is due at once");
+    check(ack_policy_data(&a, 1100, FALSE), "a packet after the delay sends the ack");
+    ack_policy_sent(&a);
+
+    check(ack_policy_data(&a, 1200, TRUE), "a gap sends the ack at once");
+    ack_policy_sent(&a);
+    check(a.acks == 3 && a.immediate == 1, "acks and immediate acks are counted");
+}